@@ -11,29 +11,78 @@
 #ifndef BASE_H_
 #define BASE_H_
 
+#include <signal.h>
+
 #include <bitset>
 #include <iostream>
 #include <string>
 #include <thread>
 #include <vector>
 
+#include "checkpoint.h"
+#include "scheduler.h"
+#include "shard.h"
 #include "timer.h"
+#include "word_store.h"
 #include "Dyck/dyck.h"
 
 // Typedefs
 
-typedef uint_fast8_t          letter_t;
-typedef std::vector<letter_t> dyck_vec_t;
-typedef size_t                dyck_index_t;
+typedef size_t dyck_index_t;
 
 static size_t const catalan_numbers[] = {1, 1, 2, 5, 14, 42, 132, 429, 1430,
   4862, 16796, 58786, 208012, 742900, 2674440, 9694845, 35357670, 129644790,
   477638700, 1767263190, 6564120420, 24466267020, 91482563640, 343059613650,
   1289904147324, 4861946401452, 18367353072152, 69533550916004,
-  263747951750360, 1002242216651368, 3814986502092304};
+  263747951750360, 1002242216651368, 3814986502092304, 14544636039226909,
+  55534064877048198};
+
+// The options shared by jones, kauffman, and motzkin, see parse_args. The
+// settings of the scheduler, the cache, and the pinning of the threads are
+// global, see scheduler.h and numa.h, and parse_args sets them directly.
+
+struct Options {
+  // Up to this number of words, there are too few pairs for more than one
+  // thread to help
+  static size_t const max_nr_words_one_thread = 1024;
+
+  Options() : verbose(false), deg(0), nr_threads(0), max_mem(0) {}
+
+  // The number of worker threads for a computation with nr_words words, which
+  // is the number given by -t, if any, or 1 if there are few words, or the
+  // default, see default_nr_threads in numa.h.
+  size_t threads(size_t nr_words) const {
+    if (nr_threads != 0) {
+      return nr_threads;
+    }
+    return (nr_words <= max_nr_words_one_thread ? 1 : default_nr_threads());
+  }
+
+  bool   verbose;
+  size_t deg;
+  size_t nr_threads;  // 0 if -t is not given
+  size_t max_mem;     // 0 if not given, see Tiles::budget
+};
 
 void print_help_and_exit(char* name) {
-  std::cout << "usage: " << name << " [-h] [-v] n" << std::endl;
+  std::cout << "usage: " << name << " [-h] [-v] [-t threads] [--scheduler s]"
+            << " [--chunk pairs] [--pin p] [--numa] [--cache m] [--max-mem m]"
+            << " [--progress t] [--resume] [--checkpoint file]"
+            << " [--checkpoint-interval t] [--time-limit t] [--shard k/N] n"
+            << std::endl;
+  std::cout << "       " << name << " [-v] --merge manifest..." << std::endl;
+  std::cout << "the scheduler s is dynamic (the default) or static, and the "
+               "threads are pinned to"
+            << std::endl;
+  std::cout << "cores by the policy p, which is none (the default), cores, or "
+               "numa (the same as --numa)"
+            << std::endl;
+  std::cout << "times are in seconds, or minutes or hours with the suffix m or "
+               "h, e.g. 90m"
+            << std::endl;
+  std::cout << "memory is in bytes, or KB, MB, or GB with the suffix K, M, or "
+               "G, e.g. 16G"
+            << std::endl;
   exit(0);
 }
 
@@ -66,25 +115,179 @@ std::string string_mem(double mem) {
   return std::to_string(mem) + suf;
 }
 
-void parse_args(int argc, char* argv[], bool& verbose, size_t& deg) {
+// Parse a time such as 600, 600s, 10m, or 0.5h into seconds
+double parse_time(char* name, char const* arg) {
+  char*  end;
+  double t = strtod(arg, &end);
+  switch (*end) {
+    case 'h':
+      t *= 60;
+      // fall through
+    case 'm':
+      t *= 60;
+      // fall through
+    case 's':
+      end++;
+      // fall through
+    default:
+      break;
+  }
+  if (*end != '\0' || t < 0) {
+    std::cerr << name << ": invalid time " << arg << std::endl;
+    exit(-1);
+  }
+  return t;
+}
+
+// Parse an amount of memory such as 1048576, 1024K, 1M, or 0.5G into bytes
+size_t parse_mem(char* name, char const* arg) {
+  char*  end;
+  double m = strtod(arg, &end);
+  switch (*end) {
+    case 'G':
+      m *= 1024;
+      // fall through
+    case 'M':
+      m *= 1024;
+      // fall through
+    case 'K':
+      m *= 1024;
+      end++;
+      // fall through
+    default:
+      break;
+  }
+  if (*end != '\0' || m < 1) {
+    std::cerr << name << ": invalid amount of memory " << arg << std::endl;
+    exit(-1);
+  }
+  return static_cast<size_t>(m);
+}
+
+// Parse a shard such as 2/8, the second of 8 shards
+void parse_shard(char* name, char const* arg, Shard& shard) {
+  char*  end;
+  size_t k = strtoul(arg, &end, 10), n = 0;
+  if (*end == '/') {
+    n = strtoul(end + 1, &end, 10);
+  }
+  if (*end != '\0' || k == 0 || n == 0 || k > n) {
+    std::cerr << name << ": invalid shard " << arg
+              << ", must be k/N with 1 <= k <= N" << std::endl;
+    exit(-1);
+  }
+  shard.index = k - 1;
+  shard.count = n;
+}
+
+// Parse a positive integer, such as a number of threads
+size_t parse_count(char* name, std::string const& opt, char const* arg) {
+  char*        end;
+  size_t const n = strtoul(arg, &end, 10);
+  if (*end != '\0' || *arg == '-' || n == 0) {
+    std::cerr << name << ": " << opt << " must be a positive integer, not "
+              << arg << std::endl;
+    exit(-1);
+  }
+  return n;
+}
+
+// If --merge is given, then the remaining arguments are the manifests to merge
+// and options.deg is not set. The options --scheduler, --chunk, and --cache
+// set scheduler_policy(), Blocks::min_block_size(), and cache_size(), see
+// scheduler.h, --pin and --numa set pin_policy(), see numa.h, and --progress
+// sets progress_interval(), see progress.h. In the NUMA mode the main thread,
+// which makes the words, is pinned to the first node. The handler of SIGUSR1
+// is installed here, before any words are made, so that the signal never
+// kills the program, even before there is any progress to report.
+void parse_args(int         argc,
+                char*       argv[],
+                Options&    options,
+                Checkpoint& checkpoint,
+                Shard&      shard) {
+  bool merge = false;
   // Not very robust parsing!
-  while (--argc) {
-    if (argv[argc][0] == '-') {
-      const char* p = argv[argc];
+  for (int i = 1; i < argc; i++) {
+    std::string const arg(argv[i]);
+    // the options which take a value
+    if (arg == "--checkpoint" || arg == "--checkpoint-interval"
+        || arg == "--time-limit" || arg == "--shard" || arg == "--max-mem"
+        || arg == "--cache" || arg == "-t" || arg == "--threads"
+        || arg == "--scheduler" || arg == "--chunk" || arg == "--pin"
+        || arg == "--progress") {
+      if (++i == argc) {
+        std::cerr << argv[0] << ": " << arg << " requires a value"
+                  << std::endl;
+        exit(-1);
+      }
+      std::string const value(argv[i]);
+      if (arg == "-t" || arg == "--threads") {
+        options.nr_threads = parse_count(argv[0], arg, argv[i]);
+      } else if (arg == "--scheduler") {
+        if (value != "dynamic" && value != "static") {
+          std::cerr << argv[0] << ": invalid scheduler " << value
+                    << ", must be dynamic or static" << std::endl;
+          exit(-1);
+        }
+        scheduler_policy() = (value == "static" ? SCHED_STATIC : SCHED_DYNAMIC);
+      } else if (arg == "--chunk") {
+        Blocks::min_block_size() = parse_count(argv[0], arg, argv[i]);
+      } else if (arg == "--pin") {
+        if (value == "none") {
+          pin_policy() = PIN_NONE;
+        } else if (value == "cores") {
+          pin_policy() = PIN_CORES;
+        } else if (value == "numa") {
+          pin_policy() = PIN_NUMA;
+        } else {
+          std::cerr << argv[0] << ": invalid pinning " << value
+                    << ", must be none, cores, or numa" << std::endl;
+          exit(-1);
+        }
+      } else if (arg == "--progress") {
+        progress_interval() = parse_time(argv[0], argv[i]);
+      } else if (arg == "--checkpoint") {
+        checkpoint.file = argv[i];
+      } else if (arg == "--checkpoint-interval") {
+        checkpoint.interval = parse_time(argv[0], argv[i]);
+        checkpoint.enabled  = true;
+      } else if (arg == "--time-limit") {
+        checkpoint.time_limit = parse_time(argv[0], argv[i]);
+      } else if (arg == "--max-mem") {
+        options.max_mem = parse_mem(argv[0], argv[i]);
+      } else if (arg == "--cache") {
+        cache_size() = parse_mem(argv[0], argv[i]);
+      } else {
+        parse_shard(argv[0], argv[i], shard);
+      }
+    } else if (arg == "--resume") {
+      checkpoint.resume = true;
+    } else if (arg == "--numa") {
+      pin_policy() = PIN_NUMA;
+    } else if (arg == "--merge") {
+      merge = true;
+    } else if (arg.compare(0, 2, "--") == 0) {
+      std::cerr << argv[0] << ": unknown option " << arg << std::endl;
+      exit(-1);
+    } else if (argv[i][0] == '-') {
+      const char* p = argv[i];
 
       while (*++p) {
         switch (*p) {
           case 'v' :
-            verbose = true;
+            options.verbose = true;
             break;
 
           case 'h' :
             print_help_and_exit(argv[0]);
         }
       }
+    } else if (merge) {
+      shard.manifests.push_back(arg);
     } else {
-      char** end = nullptr;
-      deg = strtol(argv[argc], end, 0);
+      char** end  = nullptr;
+      size_t deg  = strtol(argv[i], end, 0);
+      options.deg = deg;
       if (deg <= 0 || deg > 40) {
         std::cerr <<
           argv[0] << ": invalid argument! " << std::endl <<
@@ -93,9 +296,17 @@ void parse_args(int argc, char* argv[], bool& verbose, size_t& deg) {
       }
     }
   }
+  if (merge && shard.manifests.empty()) {
+    std::cerr << argv[0] << ": --merge requires at least one manifest"
+              << std::endl;
+    exit(-1);
+  }
+  if (numa_mode()) {
+    numa_pin(0, numa_nodes()[0]);
+  }
+  signal(SIGUSR1, progress_signal_handler);
 }
 
-
 // reverse bits in w
 dyck::integer reverse(dyck::integer w, size_t dyck_word_length) {
   size_t        nr_bits = sizeof(dyck::integer) * 8;
@@ -113,4 +324,73 @@ dyck::integer reverse(dyck::integer w, size_t dyck_word_length) {
   return (a >> (sizeof(dyck::integer) * 8 - dyck_word_length));
 }
 
+// The matching of the brackets of the Dyck word w of length 2n, and its outer
+// positions, which are those of the opening brackets which are not nested
+// inside any other bracket. Returns the number of outer positions.
+size_t make_dyck_word(dyck::integer w,
+                      size_t        n,
+                      letter_t*     word,
+                      letter_t*     outer) {
+  letter_t      stack[WordStore::max_length];
+  size_t        depth    = 0;
+  size_t        nr_outer = 0;
+  dyck::integer mask     = static_cast<dyck::integer>(1) << (2 * n - 1);
+
+  for (letter_t j = 0; j < 2 * n; j++, mask >>= 1) {
+    if (mask & w) {  // opening bracket
+      if (depth == 0) {
+        outer[nr_outer++] = j;
+      }
+      stack[depth++] = j;
+    } else {
+      depth--;
+      word[j]            = stack[depth];
+      word[stack[depth]] = j;
+    }
+  }
+  return nr_outer;
+}
+
+// The number of outer positions of the Dyck word w of length 2n, see
+// make_dyck_word
+size_t dyck_nr_outer(dyck::integer w, size_t n) {
+  size_t        depth    = 0;
+  size_t        nr_outer = 0;
+  dyck::integer mask     = static_cast<dyck::integer>(1) << (2 * n - 1);
+
+  for (size_t j = 0; j < 2 * n; j++, mask >>= 1) {
+    if (mask & w) {
+      nr_outer += (depth++ == 0);
+    } else {
+      depth--;
+    }
+  }
+  return nr_outer;
+}
+
+// Append the Dyck word w of length 2n to store, see make_dyck_word
+void push_dyck_word(WordStore& store, dyck::integer w, size_t n) {
+  letter_t     word[WordStore::max_length] = {};
+  letter_t     outer[WordStore::max_length];
+  size_t const nr_outer = make_dyck_word(w, n, word, outer);
+  store.push_back(word);
+  for (size_t k = 0; k < nr_outer; k++) {
+    store.push_outer(outer[k]);
+  }
+}
+
+// Put the Dyck word w of length 2n into position i of store, see
+// WordStore::set and make_dyck_word. Returns the number of outer positions.
+size_t set_dyck_word(WordStore&    store,
+                     size_t        i,
+                     size_t        outer_offset,
+                     dyck::integer w,
+                     size_t        n) {
+  letter_t     word[WordStore::max_length] = {};
+  letter_t     outer[WordStore::max_length];
+  size_t const nr_outer = make_dyck_word(w, n, word, outer);
+  store.set(i, outer_offset, word, outer, outer + nr_outer);
+  return nr_outer;
+}
+
 #endif  // BASE_H_
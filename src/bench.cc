@@ -0,0 +1,668 @@
+/*******************************************************************************
+
+ Copyright (C) 2016 James D. Mitchell
+
+ This work is licensed under a Creative Commons Attribution-ShareAlike 4.0
+ International License. See
+ http://creativecommons.org/licenses/by-sa/4.0/
+
+ A microbenchmark of the kernels which compare pairs of words in jones.cc,
+ kauffman.cc, and motzkin.cc, see cycles.h, loops.h, and motzkin.h. For every
+ degree, a fixed sample of the words of that degree is made, and every kernel
+ compares the same seeded random pairs of these words. The jones kernels are
+ also compared with reference implementations which use std::vector<bool> for
+ the outer positions, as jones.cc did before the masks in WordStore, and the
+ batched kernels are timed at every SIMD level supported by the processor.
+
+ Compile with:
+
+   g++ -O3 -std=c++11 -Wall -Wextra -pedantic -o bench bench.cc
+
+ and run with
+
+   bench [-o file] [-r repeats] [deg ...]
+
+ where the degrees default to 27 and 28. The time per pair of every kernel is
+ printed, and appended to file (default bench.csv) as a line of comma
+ separated values, with the revision, the host, and the compiler, so that
+ runs on different commits and machines can be compared. The revision is set
+ by make bench, see the Makefile.
+
+*******************************************************************************/
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "base.h"
+#include "cycles.h"
+#include "loops.h"
+#include "motzkin.h"
+#include "tiles.h"
+
+#ifndef BENCH_REVISION
+#define BENCH_REVISION "unknown"
+#endif
+
+static size_t const nr_sampled_words = 65536;
+static size_t const nr_pairs         = 1 << 21;
+static size_t const row_length       = 256;  // pairs per row
+static size_t const min_deg          = 2;
+static size_t const max_deg          = 32;
+
+static size_t nr_repeats = 5;
+
+// The reference implementations
+
+struct RefDyck {
+  std::vector<letter_t> word;
+  std::vector<letter_t> outer;
+  std::vector<bool>     lookup;
+};
+
+RefDyck ref_dyck(WordStore const& words, size_t i) {
+  RefDyck d;
+  d.word.assign(words[i], words[i] + words.length());
+  d.outer.assign(words.outer_begin(i), words.outer_end(i));
+  d.lookup.assign(words.length(), false);
+  for (auto const& x : d.outer) {
+    d.lookup[x] = true;
+  }
+  return d;
+}
+
+size_t ref_count_cycle(RefDyck const& u, RefDyck const& l) {
+  size_t                                max = 0, cnt = 1;
+  std::vector<letter_t>::const_iterator it  = l.outer.cbegin();
+  do {
+    while (*it < max) it++;
+    size_t pos  = *it;
+    size_t nr_u = 0, nr_l = 1;
+
+    max = l.word[pos];
+
+    if (u.lookup[pos]) nr_u++;
+
+    pos = u.word[l.word[pos]];
+
+    while (*it != pos) {
+      if (l.lookup[pos]) {
+        nr_l++;
+        max = l.word[pos];
+      } else if (u.lookup[pos]) {
+        nr_u++;
+        pos = u.word[l.word[pos]];
+        break;
+      }
+      pos = u.word[l.word[pos]];
+    }
+    while (*it != pos) {
+      if (u.lookup[pos]) nr_u++;
+      pos = u.word[l.word[pos]];
+    }
+    cnt *= (nr_u * nr_l + 1);
+  } while (max < l.outer.back());
+  return cnt;
+}
+
+size_t ref_count_cycle_odd(RefDyck const& w_i, RefDyck const& w_j) {
+  size_t const                          n   = w_i.word.back();
+  size_t                                max = 0, cnt = 1, pos;
+  std::vector<letter_t>::const_iterator it  = w_j.outer.begin();
+  do {
+    while (*it < max) {
+      it++;
+    }
+    size_t nr_i = 0, nr_j = 1;
+    max = w_j.word[*it];
+    if (w_i.lookup[*it]) {
+      nr_i++;
+    }
+    pos = w_i.word[w_j.word[*it]];
+
+    while (pos != *it && pos != n) {
+      if (w_j.lookup[pos]) {
+        nr_j++;
+        max = w_j.word[pos];
+      } else if (w_i.lookup[pos]) {
+        nr_i++;
+        pos = w_i.word[w_j.word[pos]];
+        break;
+      }
+      pos = w_i.word[w_j.word[pos]];
+    }
+    while (pos != *it && pos != n) {
+      if (w_i.lookup[pos]) {
+        nr_i++;
+      }
+      pos = w_i.word[w_j.word[pos]];
+    }
+    if (pos != n) {
+      cnt *= (nr_j * nr_i + 1);
+    }
+  } while (pos != n);
+  return cnt;
+}
+
+// The results, which are written to the file of -o
+
+struct Result {
+  std::string         kernel;
+  size_t              deg;
+  size_t              nr_words;
+  size_t              nr_pairs;
+  std::vector<double> ns_per_pair;  // one per repeat
+  size_t              sum;
+
+  double mean() const {
+    return std::accumulate(ns_per_pair.begin(), ns_per_pair.end(), 0.0)
+           / ns_per_pair.size();
+  }
+
+  double min() const {
+    return *std::min_element(ns_per_pair.begin(), ns_per_pair.end());
+  }
+
+  // The sample variance of the times per pair of the repeats
+  double variance() const {
+    if (ns_per_pair.size() < 2) {
+      return 0;
+    }
+    double const m   = mean();
+    double       var = 0;
+    for (auto const& x : ns_per_pair) {
+      var += (x - m) * (x - m);
+    }
+    return var / (ns_per_pair.size() - 1);
+  }
+};
+
+static std::vector<Result> results;
+
+// Run f(i, j) for all the pairs nr_repeats times, where every call of f
+// compares pairs_per_call pairs, print the mean time per pair, its standard
+// deviation, and the number of pairs per second, and record them in results.
+// Returns the sum of the values of f.
+
+template <typename F>
+size_t bench(std::string const&                            kernel,
+             size_t                                        deg,
+             size_t                                        nr_words,
+             std::vector<std::pair<size_t, size_t>> const& pairs,
+             F&&                                           f,
+             size_t pairs_per_call = 1) {
+  Result res = {kernel, deg, nr_words, pairs.size() * pairs_per_call, {}, 0};
+  for (size_t r = 0; r < nr_repeats; r++) {
+    Timer timer;
+    timer.start();
+    res.sum = 0;
+    for (auto const& p : pairs) {
+      res.sum += f(p.first, p.second);
+    }
+    res.ns_per_pair.push_back(1e9 * timer.elapsed() / res.nr_pairs);
+  }
+  std::cout << kernel << ": " << res.mean() << " ns/pair (+/- "
+            << std::sqrt(res.variance()) << "), " << 1e9 / res.mean()
+            << " pairs/sec" << std::endl;
+  results.push_back(res);
+  return res.sum;
+}
+
+void check_sums(std::string const& kernel, size_t sum, size_t ref_sum) {
+  if (sum != ref_sum) {
+    std::cerr << kernel << ": the sums differ!" << std::endl;
+    exit(-1);
+  }
+}
+
+// The ranks of a fixed sample of at most nr_sampled_words of nr_words words,
+// in increasing order, or all of them if there are not more
+
+std::vector<size_t> sample_ranks(size_t nr_words, std::mt19937& gen) {
+  std::vector<size_t> ranks;
+  if (nr_words <= nr_sampled_words) {
+    for (size_t r = 0; r < nr_words; r++) {
+      ranks.push_back(r);
+    }
+    return ranks;
+  }
+  std::uniform_int_distribution<size_t> rank(0, nr_words - 1);
+  for (size_t k = 0; k < nr_sampled_words; k++) {
+    ranks.push_back(rank(gen));
+  }
+  std::sort(ranks.begin(), ranks.end());
+  return ranks;
+}
+
+// The rows (i, j_begin) of pairs of a word i with the words in [j_begin,
+// j_begin + batch), of about nr_pairs pairs in total. The kernels are timed on
+// rows, since this is how jones, kauffman, and motzkin call them.
+
+std::vector<std::pair<size_t, size_t>>
+make_rows(size_t nr_words, size_t batch, std::mt19937& gen) {
+  std::uniform_int_distribution<size_t>  word(0, nr_words - 1);
+  std::uniform_int_distribution<size_t>  row(0, nr_words - batch);
+  std::vector<std::pair<size_t, size_t>> rows;
+  for (size_t k = 0; k < std::max(nr_pairs / batch, (size_t) 1); k++) {
+    size_t const i = word(gen), j = row(gen);
+    rows.emplace_back(i, j);
+  }
+  return rows;
+}
+
+// The kernels of jones.cc for the degree deg, where the Dyck words have length
+// 2n, see cycles.h
+
+void bench_jones(size_t deg, size_t n, std::mt19937& gen) {
+  bool const odd = (deg % 2 == 1);
+
+  // The reversed words are only used by the reference implementation of the
+  // odd case, since count_cycle_odd also counts the reversed pair
+  std::vector<size_t> const ranks = sample_ranks(catalan_numbers[n], gen);
+  WordStore                 words, reversed;
+  std::vector<RefDyck>      ref, ref_reversed;
+  words.reset(2 * n, ranks.size());
+  reversed.reset(2 * n, ranks.size());
+  for (size_t r : ranks) {
+    dyck::integer const w = unrank_dyck_word(r, n);
+    push_dyck_word(words, w, n);
+    ref.push_back(ref_dyck(words, words.size() - 1));
+    push_dyck_word(reversed, reverse(w, 2 * n), n);
+    ref_reversed.push_back(ref_dyck(reversed, reversed.size() - 1));
+  }
+  size_t const batch = std::min(row_length, words.size());
+  auto const   rows  = make_rows(words.size(), batch, gen);
+
+  size_t const ref_sum = bench(
+      (odd ? "jones/count_cycle_odd/vector<bool>"
+           : "jones/count_cycle/vector<bool>"),
+      deg,
+      words.size(),
+      rows,
+      [&](size_t i, size_t j_begin) {
+        size_t nr = 0;
+        for (size_t j = j_begin; j < j_begin + batch; j++) {
+          if (odd) {
+            nr += ref_count_cycle_odd(ref[i], ref[j])
+                  + ref_count_cycle_odd(ref_reversed[i], ref_reversed[j]);
+          } else {
+            nr += ref_count_cycle(ref[i], ref[j]);
+          }
+        }
+        return nr;
+      },
+      batch);
+  std::string const kernel
+      = (odd ? "jones/count_cycle_odd" : "jones/count_cycle");
+  size_t const      sum    = bench(
+      kernel,
+      deg,
+      words.size(),
+      rows,
+      [&words, odd, batch](size_t i, size_t j_begin) {
+        size_t nr = 0;
+        for (size_t j = j_begin; j < j_begin + batch; j++) {
+          if (odd) {
+            nr += count_cycle_odd(words, i, words, j);
+          } else {
+            count_cycle(nr, 1, words, i, words, j);
+          }
+        }
+        return nr;
+      },
+      batch);
+  check_sums(kernel, sum, ref_sum);
+
+  // The kernels specialised for the length of the words, and the generic
+  // kernels, see dispatch.h
+  simd_t const detected = simd_detect();
+  for (int level = SIMD_NONE; level <= detected; level++) {
+    simd_level() = static_cast<simd_t>(level);
+    for (bool generic : {false, true}) {
+      count_cycles_t const kernel
+          = (generic ? (odd ? &count_cycles_batch<true>
+                            : &count_cycles_batch<false>)
+                     : (odd ? count_cycles_kernel<true>(words.length())
+                            : count_cycles_kernel<false>(words.length())));
+      std::string const name = std::string(odd ? "jones/count_cycles_odd/"
+                                               : "jones/count_cycles/")
+                               + simd_name(simd_level())
+                               + (generic ? "/generic" : "");
+      check_sums(name,
+                 bench(
+                     name,
+                     deg,
+                     words.size(),
+                     rows,
+                     [&words, kernel, batch](size_t i, size_t j_begin) {
+                       return kernel(words, i, words, j_begin, j_begin + batch);
+                     },
+                     batch),
+                 ref_sum);
+    }
+  }
+  simd_level() = detected;
+  if (odd) {
+    return;
+  }
+
+  // A block of rows compared with all the words, row by row, and in tiles of
+  // the words which fit in the cache, see run_pairs in scheduler.h. The words
+  // only exceed the cache for the larger degrees.
+  PairSpace const space(RECTANGLE, words.size(), words.size());
+  size_t const    tile = tile_size(words);
+  std::vector<std::pair<size_t, size_t>> blocks;
+  std::uniform_int_distribution<size_t>  row(0, words.size() - batch);
+  for (size_t k = 0; k < 16; k++) {
+    blocks.emplace_back(row(gen), 0);
+  }
+  std::cout << blocks.size() << " blocks of " << batch << " rows, "
+            << words.memory() / 1024 << " KB of words, tiles of " << tile
+            << " words" << std::endl;
+  auto const count = [&words](size_t& nr) {
+    return [&words, &nr](size_t i, size_t j_begin, size_t j_end) {
+      nr += count_cycles(words, i, words, j_begin, j_end);
+    };
+  };
+  size_t const block_pairs   = batch * words.size();
+  size_t const block_ref_sum = bench(
+      "jones/block/rows",
+      deg,
+      words.size(),
+      blocks,
+      [&](size_t i, size_t) {
+        size_t nr = 0;
+        space.for_each_segment(
+            i * words.size(), (i + batch) * words.size(), count(nr));
+        return nr;
+      },
+      block_pairs);
+  check_sums("jones/block/tiles",
+             bench(
+                 "jones/block/tiles",
+                 deg,
+                 words.size(),
+                 blocks,
+                 [&](size_t i, size_t) {
+                   size_t nr = 0;
+                   space.for_each_tile(
+                       i * words.size(),
+                       (i + batch) * words.size(),
+                       tile,
+                       count(nr),
+                       [&words](size_t j_begin, size_t j_end) {
+                         words.prefetch(j_begin, j_end);
+                       });
+                   return nr;
+                 },
+                 block_pairs),
+             block_ref_sum);
+}
+
+// The kernels of kauffman.cc for the degree deg, where the Dyck words have
+// length 2n, see loops.h. Both the kernels for the palindromic words, and for
+// the non-palindromic words, which also count the reversed pairs, are timed,
+// and also without the masks of the peaks, which is the loop over all pairs.
+
+void bench_kauffman(size_t deg, size_t n, std::mt19937& gen) {
+  bool const                odd   = (deg % 2 == 1);
+  std::vector<size_t> const ranks = sample_ranks(catalan_numbers[n], gen);
+  KauffmanWords             words, unindexed;
+  words.words.reset(2 * n, ranks.size());
+  for (size_t r : ranks) {
+    push_dyck_word(words.words, unrank_dyck_word(r, n), n);
+  }
+  index_peaks(words);
+  unindexed.copy(words);
+  std::fill(unindexed.peaks.begin(), unindexed.peaks.end(), 0);
+  std::fill(unindexed.inner_peaks.begin(), unindexed.inner_peaks.end(), 0);
+  size_t const batch = std::min(row_length, words.size());
+  auto const   rows  = make_rows(words.size(), batch, gen);
+
+  // The kernels specialised for the length of the words, and the generic
+  // kernels, see dispatch.h
+  size_t const length = words.length();
+  for (bool reverse : {false, true}) {
+    count_loops_t const kernels[2][2]
+        = {{count_loops_kernel<false, false>(length),
+            count_loops_kernel<false, true>(length)},
+           {count_loops_kernel<true, false>(length),
+            count_loops_kernel<true, true>(length)}};
+    count_loops_t const generic[2][2]
+        = {{&count_even<false>, &count_even<true>},
+           {&count_odd<false>, &count_odd<true>}};
+    std::string const name = std::string("kauffman/")
+                             + (odd ? "count_odd" : "count_even")
+                             + (reverse ? "/reverse" : "");
+    size_t sums[2];
+    for (bool is_generic : {false, true}) {
+      count_loops_t const kernel
+          = (is_generic ? generic : kernels)[odd][reverse];
+      sums[is_generic] = bench(
+          name + (is_generic ? "/generic" : ""),
+          deg,
+          words.size(),
+          rows,
+          [&words, kernel, batch](size_t i, size_t j_begin) {
+            size_t nr = 0;
+            kernel(words, i, words, j_begin, j_begin + batch, 1, nr);
+            return nr;
+          },
+          batch);
+    }
+    check_sums(name + "/generic", sums[true], sums[false]);
+
+    count_loops_t const kernel = kernels[odd][reverse];
+    check_sums(name + "/unindexed",
+               bench(
+                   name + "/unindexed",
+                   deg,
+                   unindexed.size(),
+                   rows,
+                   [&unindexed, kernel, batch](size_t i, size_t j_begin) {
+                     size_t nr = 0;
+                     kernel(unindexed,
+                            i,
+                            unindexed,
+                            j_begin,
+                            j_begin + batch,
+                            1,
+                            nr);
+                     return nr;
+                   },
+                   batch),
+               sums[false]);
+  }
+}
+
+// The kernels of motzkin.cc for the degree deg, see motzkin.h, with the
+// Motzkin words of weight 0 or 1, as in main in motzkin.cc. The pairs of the
+// reflections of the words are not counted, so that the outer positions of
+// the reflections are not required. The odd rank words are ordered by their
+// signatures, and the kernel is also timed without the signature index, see
+// index_signatures.
+
+template <bool ODD>
+void bench_motzkin(size_t deg, std::mt19937& gen) {
+  size_t const length      = (ODD ? deg + 1 : deg);
+  auto const   subset_size = [length](size_t m) { return length - 2 * m; };
+  size_t       nr_words    = 0;  // the non-empty Motzkin words
+  for (size_t m = 1; 2 * m <= length; m++) {
+    nr_words += catalan_numbers[m] * binomial(deg, subset_size(m));
+  }
+
+  std::vector<size_t> ranks = sample_ranks(nr_words, gen);
+  MotzkinWords        words;
+  letter_t            word[WordStore::max_length];
+  if (ODD) {
+    std::vector<std::pair<letter_t, size_t>> sigs;
+    for (size_t r : ranks) {
+      unrank_motzkin_word(r, length, 1, deg, subset_size, word);
+      sigs.emplace_back(word[deg], r);
+    }
+    std::sort(sigs.begin(), sigs.end());
+    for (size_t k = 0; k < sigs.size(); k++) {
+      ranks[k] = sigs[k].second;
+    }
+  }
+  words.words.reset(length, ranks.size());
+  for (size_t r : ranks) {
+    unrank_motzkin_word(r, length, 1, deg, subset_size, word);
+    push_motzkin_word(words, word, deg);
+  }
+  if (ODD) {
+    index_signatures(words, deg);
+  }
+  size_t const batch = std::min(row_length, words.size());
+  auto const   rows  = make_rows(words.size(), batch, gen);
+
+  // The kernel specialised for the degree, and the generic kernel, see
+  // dispatch.h
+  std::string const name
+      = std::string("motzkin/") + (ODD ? "count_odd_rank" : "count_even_rank");
+  size_t sums[2];
+  for (bool generic : {false, true}) {
+    count_pairs_t const kernel
+        = (generic ? &count_pairs<ODD, false>
+                   : count_pairs_kernel<ODD, false>(deg));
+    sums[generic] = bench(
+        name + (generic ? "/generic" : ""),
+        deg,
+        words.size(),
+        rows,
+        [&words, kernel, deg, batch](size_t i, size_t j_begin) {
+          size_t nr = 0;
+          kernel(words, i, words, j_begin, j_begin + batch, deg, nr);
+          return nr;
+        },
+        batch);
+  }
+  check_sums(name + "/generic", sums[true], sums[false]);
+
+  if (ODD) {
+    MotzkinWords unindexed;
+    unindexed.copy(words);
+    unindexed.sig_begin.clear();
+    unindexed.sig_point.clear();
+    count_pairs_t const kernel = count_pairs_kernel<ODD, false>(deg);
+    check_sums(name + "/unindexed",
+               bench(
+                   name + "/unindexed",
+                   deg,
+                   unindexed.size(),
+                   rows,
+                   [&unindexed, kernel, deg, batch](size_t i, size_t j_begin) {
+                     size_t nr = 0;
+                     kernel(unindexed,
+                            i,
+                            unindexed,
+                            j_begin,
+                            j_begin + batch,
+                            deg,
+                            nr);
+                     return nr;
+                   },
+                   batch),
+               sums[false]);
+  }
+}
+
+std::string host_name() {
+  char name[256] = {};
+  if (gethostname(name, sizeof(name) - 1) != 0) {
+    return "unknown";
+  }
+  return name;
+}
+
+// Append the results to the file, with a header if the file is empty
+
+void write_results(std::string const& file) {
+  std::ofstream out(file, std::ios::app);
+  if (!out) {
+    std::cerr << "bench: cannot write to " << file << std::endl;
+    exit(-1);
+  }
+  if (out.tellp() == 0) {
+    out << "time,revision,host,compiler,simd,kernel,deg,words,pairs,repeats,"
+        << "ns_per_pair,ns_per_pair_min,ns_per_pair_variance,pairs_per_sec,"
+        << "sum" << std::endl;
+  }
+  std::string const host     = host_name();
+  std::string       compiler = __VERSION__;
+  std::replace(compiler.begin(), compiler.end(), ',', ' ');
+  char           time[32];
+  std::time_t    now = std::time(nullptr);
+  std::strftime(time, sizeof(time), "%Y-%m-%dT%H:%M:%S", std::gmtime(&now));
+  for (auto const& res : results) {
+    out << time << "," << BENCH_REVISION << "," << host << "," << compiler
+        << "," << simd_name(simd_detect()) << "," << res.kernel << ","
+        << res.deg << "," << res.nr_words << "," << res.nr_pairs << ","
+        << res.ns_per_pair.size() << "," << res.mean() << "," << res.min()
+        << "," << res.variance() << "," << 1e9 / res.mean() << "," << res.sum
+        << std::endl;
+  }
+  std::cout << "Appended " << results.size() << " results to " << file
+            << std::endl;
+}
+
+void print_usage_and_exit(char* name) {
+  std::cerr << "usage: " << name << " [-o file] [-r repeats] [deg ...]"
+            << std::endl;
+  exit(-1);
+}
+
+int main(int argc, char* argv[]) {
+  std::string         file = "bench.csv";
+  std::vector<size_t> degs;
+  for (int k = 1; k < argc; k++) {
+    if (strcmp(argv[k], "-o") == 0 && k + 1 < argc) {
+      file = argv[++k];
+    } else if (strcmp(argv[k], "-r") == 0 && k + 1 < argc) {
+      nr_repeats = strtoul(argv[++k], nullptr, 0);
+      if (nr_repeats == 0) {
+        print_usage_and_exit(argv[0]);
+      }
+    } else if (argv[k][0] == '-') {
+      print_usage_and_exit(argv[0]);
+    } else {
+      size_t const deg = strtoul(argv[k], nullptr, 0);
+      if (deg < min_deg || deg > max_deg) {
+        std::cerr << argv[0] << ": deg must be an integer in [" << min_deg
+                  << ", " << max_deg << "]" << std::endl;
+        exit(-1);
+      }
+      degs.push_back(deg);
+    }
+  }
+  if (degs.empty()) {
+    degs = {27, 28};
+  }
+
+  for (size_t deg : degs) {
+    // The seed only depends on the degree, so that the pairs are the same in
+    // every run
+    std::mt19937 gen(0x5eed + deg);
+    size_t const n = (deg + 1) / 2;
+    std::cout << "deg = " << deg << ", " << catalan_numbers[n]
+              << " Dyck words of length " << 2 * n << ", "
+              << std::min(catalan_numbers[n], nr_sampled_words)
+              << " sampled" << std::endl;
+    bench_jones(deg, n, gen);
+    bench_kauffman(deg, n, gen);
+    bench_motzkin<false>(deg, gen);
+    bench_motzkin<true>(deg, gen);
+  }
+  write_results(file);
+  exit(0);
+}
@@ -0,0 +1,319 @@
+/*******************************************************************************
+
+ Copyright (C) 2016 James D. Mitchell
+
+ This work is licensed under a Creative Commons Attribution-ShareAlike 4.0
+ International License. See
+ http://creativecommons.org/licenses/by-sa/4.0/
+
+*******************************************************************************/
+
+#ifndef CHECKPOINT_H_
+#define CHECKPOINT_H_
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include "shard.h"
+#include "timer.h"
+#include "uint128.h"
+
+// Exit status of a run which stopped at its time limit after writing a
+// checkpoint, so that batch scripts can tell it apart from an error.
+static int const EXIT_TIME_LIMIT = 2;
+
+// The state of a computation which consists of a sequence of phases, each of
+// which is a set of blocks of pairs of words, see run_pairs in scheduler.h.
+// This is periodically written to a file, and can be read back in with
+// --resume so that the finished phases and blocks are not computed again.
+//
+// A computation can also consist of several lanes, each of which is a
+// sequence of phases, and which can run at the same time, such as the even
+// and odd rank idempotents in motzkin.cc. Lane 0 is the checkpoint itself,
+// and the other lanes are Checkpoints whose state is written to the file of
+// the checkpoint, with the state of all the other lanes, see lane.
+//
+// The file contains the program, degree, and shard, and for every lane: the
+// sums of the finished phases, and for the current phase: its number of
+// blocks, the per-thread partial sums, and a bitmap of the finished blocks.
+
+class Checkpoint {
+ public:
+  Checkpoint()
+      : file(),
+        interval(600),
+        time_limit(0),
+        resume(false),
+        enabled(false),
+        _degree(0),
+        _done(),
+        _lanes(),
+        _last_write(0),
+        _mtx(),
+        _nr_blocks(0),
+        _partial(),
+        _phase(0),
+        _phase_sums(),
+        _program(),
+        _restored(),
+        _root(this),
+        _shard(),
+        _stop(false),
+        _timer() {}
+
+  Checkpoint(Checkpoint const&) = delete;
+  Checkpoint& operator=(Checkpoint const&) = delete;
+
+  // Settings, see parse_args in base.h
+  std::string file;        // the checkpoint file
+  double      interval;    // seconds between checkpoints
+  double      time_limit;  // seconds, 0 means no limit
+  bool        resume;      // read the checkpoint file before starting
+  bool        enabled;     // write checkpoints at all
+
+  // Must be called once the settings are known and before the first phase.
+  void init(std::string const& program, size_t degree, Shard const& shard) {
+    _program = program;
+    _degree  = degree;
+    _shard   = shard.string();
+    _timer.start();
+    enabled = enabled || resume || time_limit > 0 || !file.empty();
+    if (file.empty()) {
+      file = shard.file(program, degree, "ckpt");
+    }
+    if (resume) {
+      read();
+    }
+  }
+
+  // The lane i of the checkpoint, which is made if it does not exist yet. The
+  // settings of a lane are those of the checkpoint.
+  Checkpoint& lane(size_t i) {
+    assert(_root == this);
+    if (i == 0) {
+      return *this;
+    }
+    std::lock_guard<std::mutex> lg(_mtx);
+    while (_lanes.size() < i) {
+      _lanes.emplace_back(new Checkpoint());
+      _lanes.back()->_root = this;
+    }
+    return *_lanes[i - 1];
+  }
+
+  // Called at the start of a phase with nr_blocks blocks. Returns true if the
+  // phase was finished in a previous run, in which case its sum is added to
+  // sums[0]. Otherwise, the partial sums of the phase from a previous run, if
+  // any, are added to sums.
+  bool begin_phase(size_t nr_blocks, std::vector<uint128_t>& sums) {
+    std::lock_guard<std::mutex> lg(_root->_mtx);
+    if (_phase < _phase_sums.size()) {
+      sums[0] += _phase_sums[_phase++];
+      return true;
+    }
+    if (_restored.empty()) {
+      _done.assign((nr_blocks + 63) / 64, 0);
+      _partial.assign(sums.size(), 0);
+    } else if (nr_blocks != _nr_blocks) {
+      std::cerr << "checkpoint: " << _root->file << " has " << _nr_blocks
+                << " blocks in phase " << _phase << ", not " << nr_blocks
+                << std::endl;
+      exit(-1);
+    } else {
+      for (size_t i = 0; i < _partial.size(); i++) {
+        sums[i % sums.size()] += _partial[i];
+      }
+    }
+    _nr_blocks = nr_blocks;
+    return false;
+  }
+
+  // Is the block one that was finished in a previous run?
+  bool is_done(size_t block) const {
+    return !_restored.empty() && ((_restored[block / 64] >> (block % 64)) & 1);
+  }
+
+  // Record that the thread finished the block, and that the sum of the block
+  // is sum. This also writes the checkpoint, and checks the time limit, when
+  // they are due.
+  void complete(size_t thread_id, size_t block, uint128_t sum) {
+    Checkpoint&                 root = *_root;
+    std::lock_guard<std::mutex> lg(root._mtx);
+    _done[block / 64] |= static_cast<uint64_t>(1) << (block % 64);
+    if (thread_id >= _partial.size()) {
+      _partial.resize(thread_id + 1, 0);
+    }
+    _partial[thread_id] += sum;
+    double const now = root._timer.elapsed();
+    if (root.time_limit > 0 && now >= root.time_limit) {
+      root._stop = true;
+    } else if (root.enabled && now - root._last_write >= root.interval) {
+      root.write();
+    }
+  }
+
+  // Should the threads stop taking new blocks?
+  std::atomic<bool> const& stop() const {
+    return _root->_stop;
+  }
+
+  // Called at the end of a phase, if the time limit was reached, then the
+  // checkpoint, with every lane, is written and the program exits. This uses
+  // quick_exit, rather than exit, since the threads of the other lanes may
+  // still be running, and so the words which they read are not destroyed.
+  void end_phase() {
+    Checkpoint&                 root = *_root;
+    std::lock_guard<std::mutex> lg(root._mtx);
+    if (root._stop) {
+      root.write();
+      std::cerr << "Time limit reached, checkpoint written to " << root.file
+                << ", continue with --resume" << std::endl;
+      std::cout.flush();
+      std::quick_exit(EXIT_TIME_LIMIT);
+    }
+    _phase_sums.push_back(
+        std::accumulate(_partial.begin(), _partial.end(), (uint128_t) 0));
+    _phase++;
+    _restored.clear();
+    _done.clear();
+    _partial.clear();
+    if (root.enabled) {
+      root.write();
+    }
+  }
+
+  // The sums of the finished phases, of every lane in turn
+  std::vector<uint128_t> phase_sums() const {
+    std::lock_guard<std::mutex> lg(_root->_mtx);
+    std::vector<uint128_t>      out = _phase_sums;
+    for (auto const& lane : _lanes) {
+      out.insert(out.end(), lane->_phase_sums.begin(), lane->_phase_sums.end());
+    }
+    return out;
+  }
+
+  // Called when the computation is finished, the checkpoint is no longer
+  // required.
+  void finish() {
+    if (enabled) {
+      remove(file.c_str());
+    }
+  }
+
+ private:
+  // Must be called with _mtx locked
+  void write() {
+    std::string   tmp = file + ".tmp";
+    std::ofstream out(tmp);
+    out << "program " << _program << "\n";
+    out << "degree " << _degree << "\n";
+    out << "shard " << _shard << "\n";
+    out << "lanes " << _lanes.size() + 1 << "\n";
+    write_lane(out);
+    for (auto const& lane : _lanes) {
+      lane->write_lane(out);
+    }
+    out.close();
+    if (!out || rename(tmp.c_str(), file.c_str()) != 0) {
+      std::cerr << "checkpoint: cannot write " << file << std::endl;
+    }
+    _last_write = _timer.elapsed();
+  }
+
+  void write_lane(std::ofstream& out) const {
+    out << "phases " << _phase_sums.size();
+    for (auto const& x : _phase_sums) {
+      out << " " << x;
+    }
+    out << "\nblocks " << _nr_blocks << "\n";
+    out << "partial " << _partial.size();
+    for (auto const& x : _partial) {
+      out << " " << x;
+    }
+    out << "\ndone " << _done.size();
+    for (auto const& x : _done) {
+      out << " " << x;
+    }
+    out << "\n";
+  }
+
+  void read() {
+    std::ifstream in(file);
+    if (!in) {
+      std::cerr << "No checkpoint " << file << " found, starting from scratch"
+                << std::endl;
+      return;
+    }
+    std::string key, program, shard;
+    size_t      degree = 0, nr_lanes = 0;
+    in >> key >> program >> key >> degree >> key >> shard;
+    if (!in || program != _program || degree != _degree || shard != _shard) {
+      std::cerr << "checkpoint: " << file << " is not for " << _program << " "
+                << _degree << " shard " << _shard << std::endl;
+      exit(-1);
+    }
+    in >> key >> nr_lanes;
+    for (size_t i = 0; in && i < nr_lanes; i++) {
+      lane(i).read_lane(in);
+    }
+    if (!in || nr_lanes == 0) {
+      std::cerr << "checkpoint: cannot read " << file << std::endl;
+      exit(-1);
+    }
+    std::cerr << "Resuming from " << file << " at phase " << _phase_sums.size();
+    for (auto const& lane : _lanes) {
+      std::cerr << ", " << lane->_phase_sums.size();
+    }
+    std::cerr << std::endl;
+  }
+
+  void read_lane(std::ifstream& in) {
+    std::string key;
+    size_t      nr = 0;
+    in >> key >> nr;
+    _phase_sums.resize(nr);
+    for (auto& x : _phase_sums) {
+      in >> x;
+    }
+    in >> key >> _nr_blocks >> key >> nr;
+    _partial.resize(nr);
+    for (auto& x : _partial) {
+      in >> x;
+    }
+    in >> key >> nr;
+    _restored.resize(nr);
+    for (auto& x : _restored) {
+      in >> x;
+    }
+    _done = _restored;
+  }
+
+  size_t                                   _degree;
+  std::vector<uint64_t>                    _done;
+  std::vector<std::unique_ptr<Checkpoint>> _lanes;  // 1, 2, ...
+  double                                   _last_write;
+  mutable std::mutex                       _mtx;  // of every lane
+  size_t                                   _nr_blocks;
+  std::vector<uint128_t>                   _partial;
+  size_t                                   _phase;
+  std::vector<uint128_t>                   _phase_sums;
+  std::string                              _program;
+  std::vector<uint64_t>                    _restored;
+  Checkpoint*                              _root;  // lane 0
+  std::string                              _shard;
+  std::atomic<bool>                        _stop;
+  Timer                                    _timer;
+};
+
+#endif  // CHECKPOINT_H_
@@ -0,0 +1,450 @@
+/*******************************************************************************
+
+ Copyright (C) 2016 James D. Mitchell
+
+ This work is licensed under a Creative Commons Attribution-ShareAlike 4.0
+ International License. See
+ http://creativecommons.org/licenses/by-sa/4.0/
+
+*******************************************************************************/
+
+#ifndef CYCLES_H_
+#define CYCLES_H_
+
+#include <assert.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "dispatch.h"
+#include "uint128.h"
+#include "word_store.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define CYCLES_SIMD
+#include <immintrin.h>
+#endif
+
+// The kernels which compare a pair of Dyck words u and l, in jones.cc. Every
+// cycle of the permutation u(l(.)) which contains an outer position of l
+// contributes a factor nr_u * nr_l + 1, where nr_u and nr_l are the numbers
+// of outer positions of u and l in the cycle.
+//
+// The positions of a cycle are collected in a mask, so that nr_u and nr_l are
+// popcounts, and the next cycle starts at the lowest outer position of l which
+// is not in any previous cycle.
+
+inline void count_cycle(size_t&          nr_idempotents,
+                        size_t           multiplier,
+                        WordStore const& upper,
+                        size_t           i,
+                        WordStore const& lower,
+                        size_t           j) {
+  letter_t const*   u       = upper[i];
+  letter_t const*   l       = lower[j];
+  word_mask_t const u_outer = upper.outer_mask(i);
+  word_mask_t const l_outer = lower.outer_mask(j);
+  word_mask_t       todo    = l_outer;
+  size_t            cnt     = 1;
+  do {
+    size_t const start = lowest_bit(todo);
+    size_t       pos   = start;
+    word_mask_t  cycle = 0;
+    do {
+      cycle |= bit(pos);
+      pos = u[l[pos]];
+    } while (pos != start);
+    cnt *= (popcount(cycle & u_outer) * popcount(cycle & l_outer) + 1);
+    todo &= ~cycle;
+  } while (todo != 0);
+  nr_idempotents += (multiplier * cnt);
+}
+
+// In the odd case, the words have length deg + 1, and the number of
+// idempotents from the pair (u, l) is the product over the cycles, as above,
+// except the last cycle, which contains the last positions of u and l. Since
+// reversing u and l reverses the cycles, the number from the pair (reverse(u),
+// reverse(l)) is the product over the cycles except the first, which contains
+// position 0. This returns the sum of both, so that jones.cc only has to
+// compare one of each pair of reversed pairs of words, as in the even case.
+// If LENGTH is not 0, then it is the length of the words, see dispatch.h.
+
+template <size_t LENGTH = 0>
+inline size_t count_cycle_odd(WordStore const& upper,
+                              size_t           i,
+                              WordStore const& lower,
+                              size_t           j) {
+  letter_t const*   u         = upper[i];
+  letter_t const*   l         = lower[j];
+  word_mask_t const u_outer   = upper.outer_mask(i);
+  word_mask_t const l_outer   = lower.outer_mask(j);
+  size_t const      n         = u[word_length<LENGTH>(upper) - 1];
+  word_mask_t       todo      = l_outer;
+  size_t            not_first = 1, not_last = 1;
+  do {
+    size_t const start = lowest_bit(todo);
+    size_t       pos   = start;
+    word_mask_t  cycle = 0;
+    do {
+      cycle |= bit(pos);
+      pos = u[l[pos]];
+    } while (pos != start);
+    size_t const cnt
+        = popcount(cycle & u_outer) * popcount(cycle & l_outer) + 1;
+    if (!(cycle & bit(0))) {
+      not_first *= cnt;
+    }
+    if (!(cycle & bit(n))) {
+      not_last *= cnt;
+    }
+    todo &= ~cycle;
+  } while (todo != 0);
+  return not_first + not_last;
+}
+
+// The batched kernels count_cycles and count_cycles_odd, below, compare the
+// word i in upper with every word j in [j_begin, j_end) in lower, and return
+// the sum of the values of count_cycle (with multiplier 1) or count_cycle_odd.
+// They use SIMD kernels if the processor supports them, which is detected at
+// run time, and the scalar kernels above otherwise. The sums are identical in
+// every case.
+
+enum simd_t { SIMD_NONE, SIMD_AVX2, SIMD_AVX512 };
+
+inline simd_t simd_detect() {
+#ifdef CYCLES_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512bw")
+      && __builtin_cpu_supports("avx512vbmi")) {
+    return SIMD_AVX512;
+  } else if (__builtin_cpu_supports("avx2")) {
+    return SIMD_AVX2;
+  }
+#endif
+  return SIMD_NONE;
+}
+
+// The level of the kernels used by count_cycles and count_cycles_odd, this can
+// be lowered, but not raised above simd_detect().
+inline simd_t& simd_level() {
+  static simd_t level = simd_detect();
+  return level;
+}
+
+inline char const* simd_name(simd_t level) {
+  switch (level) {
+    case SIMD_AVX512:
+      return "AVX-512";
+    case SIMD_AVX2:
+      return "AVX2";
+    default:
+      return "scalar";
+  }
+}
+
+#ifdef CYCLES_SIMD
+
+// In the SIMD kernels the positions are the byte lanes of a vector, and the
+// lanes beyond the length of the words are fixed points. The word i in upper
+// is loaded once, and then for every word l in lower:
+//
+//   1. p = u(l(.)) is a byte shuffle;
+//   2. every position x is labelled by the least position in its cycle in p by
+//      pointer doubling: after k rounds the label of x is the least of x, p(x),
+//      ..., p^(2^k - 1)(x), where a round is the shuffles p := p(p(.)) and
+//      label := min(label, label(p(.)));
+//   3. the cycles are processed in the same order as in count_cycle and
+//      count_cycle_odd, where the mask of a cycle is given by comparing the
+//      labels with the label of its start.
+
+static_assert(sizeof(letter_t) == 1, "the SIMD kernels need 1 byte letters");
+
+alignas(64) static uint8_t const simd_identity[64]
+    = {0,  1,  2,  3,  4,  5,  6,  7,  8,  9,  10, 11, 12, 13, 14, 15,
+       16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31,
+       32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47,
+       48, 49, 50, 51, 52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 62, 63};
+
+// The number of rounds of pointer doubling so that 2 ^ rounds >= length, which
+// is at least the length of any cycle.
+inline size_t simd_nr_rounds(size_t length) {
+  size_t rounds = 0;
+  while ((static_cast<size_t>(1) << rounds) < length) {
+    rounds++;
+  }
+  return rounds;
+}
+
+// Multiply the products by the factor of the cycle, as in count_cycle if ODD is
+// false, and count_cycle_odd if ODD is true.
+template <bool ODD>
+inline void simd_count(word_mask_t cycle,
+                       word_mask_t u_outer,
+                       word_mask_t l_outer,
+                       size_t      n,
+                       size_t&     cnt,
+                       size_t&     not_first,
+                       size_t&     not_last) {
+  size_t const factor
+      = popcount(cycle & u_outer) * popcount(cycle & l_outer) + 1;
+  if (!ODD) {
+    cnt *= factor;
+    return;
+  }
+  if (!(cycle & bit(0))) {
+    not_first *= factor;
+  }
+  if (!(cycle & bit(n))) {
+    not_last *= factor;
+  }
+}
+
+// AVX-512, where a shuffle of all 64 lanes is a single instruction.
+
+// Returns table(index(.)), this is _mm512_permutexvar_epi8 with a mask, which
+// compiles to the same instruction without the spurious warnings of gcc 12.
+__attribute__((target("avx512f,avx512bw,avx512vbmi"))) inline __m512i
+avx512_compose(__m512i table, __m512i index) {
+  return _mm512_maskz_permutexvar_epi8(~0ULL, index, table);
+}
+
+template <bool ODD, size_t LENGTH>
+__attribute__((target("avx512f,avx512bw,avx512vbmi"))) size_t
+count_cycles_avx512(WordStore const& upper,
+                    size_t           i,
+                    WordStore const& lower,
+                    size_t           j_begin,
+                    size_t           j_end) {
+  size_t const      length  = word_length<LENGTH>(lower);
+  __mmask64 const   in      = (length == 64 ? ~0ULL : bit(length) - 1);
+  __m512i const     id      = _mm512_load_si512(simd_identity);
+  __m512i const     u       = _mm512_mask_loadu_epi8(id, in, upper[i]);
+  word_mask_t const u_outer = upper.outer_mask(i);
+  size_t const      n       = (ODD ? upper[i][length - 1] : length);
+  size_t const      rounds  = simd_nr_rounds(length);
+  size_t            sum     = 0;
+
+  for (size_t j = j_begin; j < j_end; j++) {
+    __m512i const l     = _mm512_mask_loadu_epi8(id, in, lower[j]);
+    __m512i       p     = avx512_compose(u, l);
+    __m512i       label = _mm512_min_epu8(id, p);
+    for (size_t k = 1; k < rounds; k++) {
+      p     = avx512_compose(p, p);
+      label = _mm512_min_epu8(label, avx512_compose(label, p));
+    }
+
+    word_mask_t const l_outer = lower.outer_mask(j);
+    word_mask_t       todo    = l_outer;
+    size_t            cnt     = 1, not_first = 1, not_last = 1;
+    do {
+      __m512i const     start = _mm512_set1_epi8(lowest_bit(todo));
+      word_mask_t const cycle
+          = _mm512_cmpeq_epi8_mask(label, avx512_compose(label, start));
+      simd_count<ODD>(cycle, u_outer, l_outer, n, cnt, not_first, not_last);
+      todo &= ~cycle;
+    } while (todo != 0);
+    sum += (ODD ? not_first + not_last : cnt);
+  }
+  return sum;
+}
+
+// AVX2, where _mm256_shuffle_epi8 only shuffles within 16 byte lanes, and so
+// a shuffle by a table of NC chunks of 16 bytes is a blend of NC shuffles, by
+// each chunk broadcast to both lanes. This is only used for words of length at
+// most 32, which fit in one vector, since for longer words the extra shuffles
+// and blends make it slower than the scalar kernels.
+
+// Returns table(index(.)), where the entries of index are less than 16 * NC
+template <size_t NC>
+__attribute__((target("avx2"))) inline __m256i
+avx2_compose(__m256i table, __m256i index) {
+  __m256i const lo  = _mm256_permute2x128_si256(table, table, 0x00);
+  __m256i       out = _mm256_shuffle_epi8(lo, index);
+  if (NC > 1) {
+    __m256i const hi = _mm256_permute2x128_si256(table, table, 0x11);
+    __m256i const in = _mm256_cmpgt_epi8(index, _mm256_set1_epi8(15));
+    out = _mm256_blendv_epi8(out, _mm256_shuffle_epi8(hi, index), in);
+  }
+  return out;
+}
+
+// Returns the word w, with the lanes which are not set in the mask in taken
+// from id
+__attribute__((target("avx2"))) inline __m256i
+avx2_load(letter_t const* w, __m256i id, __m256i in) {
+  __m256i const v = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(w));
+  return _mm256_blendv_epi8(id, v, in);
+}
+
+template <size_t NC, bool ODD, size_t LENGTH>
+__attribute__((target("avx2"))) size_t
+count_cycles_avx2(WordStore const& upper,
+                  size_t           i,
+                  WordStore const& lower,
+                  size_t           j_begin,
+                  size_t           j_end) {
+  static_assert(NC == 1 || NC == 2, "the words must have length at most 32");
+  __m256i const* const identity
+      = reinterpret_cast<__m256i const*>(simd_identity);
+  size_t const      length  = word_length<LENGTH>(lower);
+  __m256i const     id      = _mm256_load_si256(identity);
+  __m256i const     in      = _mm256_cmpgt_epi8(_mm256_set1_epi8(length), id);
+  __m256i const     u       = avx2_load(upper[i], id, in);
+  word_mask_t const u_outer = upper.outer_mask(i);
+  size_t const      n       = (ODD ? upper[i][length - 1] : length);
+  size_t const      rounds  = simd_nr_rounds(length);
+  size_t            sum     = 0;
+
+  alignas(32) uint8_t labels[32];
+
+  for (size_t j = j_begin; j < j_end; j++) {
+    __m256i const l     = avx2_load(lower[j], id, in);
+    __m256i       p     = avx2_compose<NC>(u, l);
+    __m256i       label = _mm256_min_epu8(id, p);
+    for (size_t k = 1; k < rounds; k++) {
+      p     = avx2_compose<NC>(p, p);
+      label = _mm256_min_epu8(label, avx2_compose<NC>(label, p));
+    }
+    _mm256_store_si256(reinterpret_cast<__m256i*>(labels), label);
+
+    word_mask_t const l_outer = lower.outer_mask(j);
+    word_mask_t       todo    = l_outer;
+    size_t            cnt     = 1, not_first = 1, not_last = 1;
+    do {
+      __m256i const     start = _mm256_set1_epi8(labels[lowest_bit(todo)]);
+      word_mask_t const cycle = static_cast<uint32_t>(
+          _mm256_movemask_epi8(_mm256_cmpeq_epi8(label, start)));
+      simd_count<ODD>(cycle, u_outer, l_outer, n, cnt, not_first, not_last);
+      todo &= ~cycle;
+    } while (todo != 0);
+    sum += (ODD ? not_first + not_last : cnt);
+  }
+  return sum;
+}
+
+#endif  // CYCLES_SIMD
+
+// If LENGTH is not 0, then it is the length of the words, and the number of
+// rounds of the SIMD kernels is a constant, see dispatch.h.
+
+template <bool ODD, size_t LENGTH = 0>
+size_t count_cycles_batch(WordStore const& upper,
+                          size_t           i,
+                          WordStore const& lower,
+                          size_t           j_begin,
+                          size_t           j_end) {
+  assert(upper.length() == lower.length());
+  assert(LENGTH == 0 || LENGTH == lower.length());
+#ifdef CYCLES_SIMD
+  size_t const length = word_length<LENGTH>(lower);
+  if (simd_level() == SIMD_AVX512) {
+    return count_cycles_avx512<ODD, LENGTH>(upper, i, lower, j_begin, j_end);
+  } else if (simd_level() == SIMD_AVX2 && length <= 16) {
+    return count_cycles_avx2<1, ODD, LENGTH>(upper, i, lower, j_begin, j_end);
+  } else if (simd_level() == SIMD_AVX2 && length <= 32) {
+    return count_cycles_avx2<2, ODD, LENGTH>(upper, i, lower, j_begin, j_end);
+  }
+#endif
+  size_t sum = 0;
+  for (size_t j = j_begin; j < j_end; j++) {
+    if (ODD) {
+      sum += count_cycle_odd<LENGTH>(upper, i, lower, j);
+    } else {
+      count_cycle(sum, 1, upper, i, lower, j);
+    }
+  }
+  return sum;
+}
+
+typedef size_t (*count_cycles_t)(WordStore const&,
+                                 size_t,
+                                 WordStore const&,
+                                 size_t,
+                                 size_t);
+
+template <bool ODD> struct CountCycles {
+  typedef count_cycles_t type;
+
+  template <size_t LENGTH> static type get() {
+    return &count_cycles_batch<ODD, LENGTH>;
+  }
+};
+
+// The batched kernel for Dyck words of the given length, which is specialised
+// for every even length of the words of the degrees up to
+// max_specialised_deg, see dispatch.h.
+
+template <bool ODD> count_cycles_t count_cycles_kernel(size_t length) {
+  static std::vector<count_cycles_t> const table
+      = dispatch_table<CountCycles<ODD>,
+                       2,
+                       2 * ((max_specialised_deg + 1) / 2),
+                       2>();
+  return dispatch(table, length);
+}
+
+inline size_t count_cycles(WordStore const& upper,
+                           size_t           i,
+                           WordStore const& lower,
+                           size_t           j_begin,
+                           size_t           j_end) {
+  return count_cycles_kernel<false>(lower.length())(
+      upper, i, lower, j_begin, j_end);
+}
+
+inline size_t count_cycles_odd(WordStore const& upper,
+                               size_t           i,
+                               WordStore const& lower,
+                               size_t           j_begin,
+                               size_t           j_end) {
+  return count_cycles_kernel<true>(lower.length())(
+      upper, i, lower, j_begin, j_end);
+}
+
+// The kernel policy of jones.cc, see engine.h. In the even case the number
+// from a pair and its reverse are equal, and in the odd case count_cycles_odd
+// counts both at once. So count<false> is the number from a pair and its
+// reverse, which is the same pair for palindromic words, and count<true> is
+// twice that, the number from a pair and its reverse, and from the pair of
+// the reverses and its reverse.
+//
+// The number of idempotents from the pair (w, w) is 2 to the power of the
+// number of outer positions of w. In the odd case the outer arc ending at the
+// last position is never opened.
+
+template <bool ODD> struct JonesPolicy {
+  typedef WordStore words_type;
+
+  static bool const has_diagonal   = true;
+  static bool const has_cost_model = false;
+
+  static char const* reverses() {
+    return "reverses";
+  }
+
+  // The kernel for the words of the given length is chosen once, here
+  explicit JonesPolicy(size_t length)
+      : kernel(count_cycles_kernel<ODD>(length)) {}
+
+  template <bool REFLECT>
+  void count(WordStore const& upper,
+             size_t           i,
+             WordStore const& lower,
+             size_t           j_begin,
+             size_t           j_end,
+             size_t&          sum) const {
+    add_checked(sum,
+                (REFLECT ? 2 : 1) * (ODD ? 1 : 2)
+                    * kernel(upper, i, lower, j_begin, j_end));
+  }
+
+  template <bool REFLECT>
+  size_t diagonal(WordStore const& words, size_t i) const {
+    return (REFLECT ? 2 : 1)
+           * (static_cast<size_t>(1) << (words.nr_outer(i) - (ODD ? 1 : 0)));
+  }
+
+  count_cycles_t kernel;
+};
+
+#endif  // CYCLES_H_
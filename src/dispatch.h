@@ -0,0 +1,75 @@
+/*******************************************************************************
+
+ Copyright (C) 2016 James D. Mitchell
+
+ This work is licensed under a Creative Commons Attribution-ShareAlike 4.0
+ International License. See
+ http://creativecommons.org/licenses/by-sa/4.0/
+
+*******************************************************************************/
+
+// Tables of the kernels specialised for every length of the words, or for
+// every degree, which is chosen once, when a program starts. In the
+// specialised kernels the length is a compile-time constant, so that the loop
+// bounds and the sentinels of the walks are constants, and the loops over the
+// positions of a word can be unrolled. The kernel for the length 0 is the
+// generic kernel, which reads the length of the words at run time, and which
+// is used for the lengths which are not specialised.
+
+#ifndef DISPATCH_H_
+#define DISPATCH_H_
+
+#include <vector>
+
+#include "word_store.h"
+
+// The degrees which the programs accept, see parse_args in base.h
+static size_t const max_specialised_deg = 40;
+
+// The length of the words of a kernel specialised for LENGTH, or of the words
+// in store if LENGTH is 0
+template <size_t LENGTH, typename S> inline size_t word_length(S const& store) {
+  return (LENGTH == 0 ? store.length() : LENGTH);
+}
+
+// K has a type, the type of a pointer to a kernel, and get<L>(), which returns
+// the kernel specialised for L. DispatchFill puts get<L>() into table[L] for L
+// in FIRST, FIRST + STEP, ..., up to LAST.
+
+template <typename K,
+          size_t L,
+          size_t LAST,
+          size_t STEP,
+          bool   = (L <= LAST)>
+struct DispatchFill {
+  static void fill(typename K::type* table) {
+    table[L] = K::template get<L>();
+    DispatchFill<K, L + STEP, LAST, STEP>::fill(table);
+  }
+};
+
+template <typename K, size_t L, size_t LAST, size_t STEP>
+struct DispatchFill<K, L, LAST, STEP, false> {
+  static void fill(typename K::type*) {}
+};
+
+// The table of the kernels of K for the lengths [0, LAST], where the lengths
+// FIRST, FIRST + STEP, ..., up to LAST have specialised kernels, and the others
+// have the generic kernel get<0>().
+
+template <typename K, size_t FIRST, size_t LAST, size_t STEP = 1>
+std::vector<typename K::type> dispatch_table() {
+  std::vector<typename K::type> table(LAST + 1, K::template get<0>());
+  DispatchFill<K, FIRST, LAST, STEP>::fill(table.data());
+  return table;
+}
+
+// The kernel for the length in the table, or the generic kernel if there is
+// no kernel for this length in the table
+
+template <typename T>
+T dispatch(std::vector<T> const& table, size_t length) {
+  return (length < table.size() ? table[length] : table[0]);
+}
+
+#endif  // DISPATCH_H_
@@ -0,0 +1,508 @@
+/*******************************************************************************
+
+ Copyright (C) 2016 James D. Mitchell
+
+ This work is licensed under a Creative Commons Attribution-ShareAlike 4.0
+ International License. See
+ http://creativecommons.org/licenses/by-sa/4.0/
+
+*******************************************************************************/
+
+// The engine which counts the idempotents from the pairs of words in jones.cc,
+// kauffman.cc, and motzkin.cc. The words are split by a symmetry, the reversal
+// of Dyck words or the reflection of Motzkin words, into the palindromic
+// words, the non-palindromic words, and their reverses, see SymmetricWords.
+// The pairs of these words are compared in four phases, by the scheduler in
+// scheduler.h, or in tiles in the streaming mode, see tiles.h.
+//
+// The engine is a template over a kernel policy P, which compares the pairs,
+// so that the kernels are inlined into the loops of the threads. P has
+//
+//   words_type: the type of the words, WordStore, KauffmanWords, or
+//   MotzkinWords;
+//
+//   has_diagonal: if true, then the pairs (i, i) of a word and itself are
+//   counted by diagonal, otherwise they are not counted by the engine;
+//
+//   has_cost_model: if true, then the blocks of pairs have roughly equal
+//   costs according to a CostModel measured with steps, otherwise they have
+//   roughly equal numbers of pairs;
+//
+//   reverses(): the name of the reverses of the words, for -v;
+//
+//   count<REFLECT>(u, i, l, j_begin, j_end, sum): which adds the number of
+//   idempotents from the pairs (u[i], l[j]) for j in [j_begin, j_end) to sum,
+//   and if REFLECT is true, also from the pairs of their reverses;
+//
+//   diagonal<REFLECT>(u, i): the number from the pair (u[i], u[i]), and if
+//   REFLECT is true, also from the pair of its reverse and itself;
+//
+//   steps<REFLECT>(u, i, l, j): the cost of the pair (u[i], l[j]), which is
+//   only used if has_cost_model is true.
+
+#ifndef ENGINE_H_
+#define ENGINE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "base.h"
+#include "scheduler.h"
+#include "tiles.h"
+
+// The palindromic words, the non-palindromic words which are less than their
+// reverses, and their reverses, so that every word is either in palin or is
+// the i-th word in nonpalin or nonpalin_r, and its reverse is the i-th word of
+// the other one. The copies on every NUMA node are made by replicate.
+
+template <typename W> struct SymmetricWords {
+  SymmetricWords()
+      : palin(),
+        nonpalin(),
+        nonpalin_r(),
+        palin_numa(palin),
+        nonpalin_numa(nonpalin),
+        nonpalin_r_numa(nonpalin_r) {}
+
+  SymmetricWords(SymmetricWords const&) = delete;
+  SymmetricWords& operator=(SymmetricWords const&) = delete;
+
+  size_t memory() const {
+    return palin.memory() + nonpalin.memory() + nonpalin_r.memory();
+  }
+
+  // Free the words, and their copies, once they are no longer required
+  void clear() {
+    palin_numa.clear();
+    nonpalin_numa.clear();
+    nonpalin_r_numa.clear();
+    palin.clear();
+    nonpalin.clear();
+    nonpalin_r.clear();
+  }
+
+  void replicate() {
+    palin_numa.replicate();
+    nonpalin_numa.replicate();
+    nonpalin_r_numa.replicate();
+  }
+
+  W             palin;
+  W             nonpalin;
+  W             nonpalin_r;
+  Replicated<W> palin_numa;
+  Replicated<W> nonpalin_numa;
+  Replicated<W> nonpalin_r_numa;
+};
+
+// Run f(k) in a new thread for every k in [0, nr_threads), and wait for them.
+// If worker_pool() is set, then the workers of the pool run f(k) instead.
+
+inline void run_threads(size_t                             nr_threads,
+                        std::function<void(size_t)> const& f) {
+  WorkerPool* pool = worker_pool();
+  if (pool != nullptr) {
+    std::atomic<size_t> next(0);
+    pool->run([nr_threads, &f, &next](size_t) {
+      size_t const k = next++;
+      if (k >= nr_threads) {
+        return false;
+      }
+      f(k);
+      return true;
+    });
+    return;
+  }
+  std::vector<std::thread> threads;
+  for (size_t k = 0; k < nr_threads; k++) {
+    threads.emplace_back(f, k);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+// Put the Dyck words of length 2n into words, using nr_threads threads. A
+// word w is palindromic if w == reverse(w), and otherwise it is in nonpalin if
+// it is less than its reverse, which is then in nonpalin_r, so that the words
+// are classified without looking up their reverses. Every thread enumerates
+// its own range of the Dyck words twice, see for_each_dyck_word: first to
+// count the words and the outer positions of each kind in the range, and then
+// to put them into the stores, which are allocated in between, at the
+// positions after those of the ranges before it. So the words are in the same
+// order for any number of threads.
+
+void init_dyck_words(WordStore& palin,
+                     WordStore& nonpalin,
+                     WordStore& nonpalin_r,
+                     size_t     n,
+                     size_t     nr_threads) {
+  // The numbers of palindromic and non-palindromic words, and of their outer
+  // positions, in a range, or before it. A word and its reverse have the same
+  // number of outer positions.
+  struct Counts {
+    size_t palin;
+    size_t palin_outer;
+    size_t nonpalin;
+    size_t nonpalin_outer;
+  };
+  size_t const        nr_dyck_words = catalan_numbers[n];
+  nr_threads                        = std::max(nr_threads, (size_t) 1);
+  std::vector<Counts> counts(nr_threads + 1, Counts());
+
+  auto const range = [nr_dyck_words, nr_threads](size_t k) {
+    return (k * nr_dyck_words) / nr_threads;
+  };
+  run_threads(nr_threads, [&](size_t k) {
+    Counts& c = counts[k + 1];
+    for_each_dyck_word(
+        n, range(k), range(k + 1), [&c, n](size_t, dyck::integer w) {
+          dyck::integer const ww = reverse(w, 2 * n);
+          if (ww == w) {
+            c.palin++;
+            c.palin_outer += dyck_nr_outer(w, n);
+          } else if (w < ww) {
+            c.nonpalin++;
+            c.nonpalin_outer += dyck_nr_outer(w, n);
+          }
+        });
+  });
+  for (size_t k = 1; k <= nr_threads; k++) {
+    counts[k].palin += counts[k - 1].palin;
+    counts[k].palin_outer += counts[k - 1].palin_outer;
+    counts[k].nonpalin += counts[k - 1].nonpalin;
+    counts[k].nonpalin_outer += counts[k - 1].nonpalin_outer;
+  }
+
+  Counts const& total = counts[nr_threads];
+  palin.resize(2 * n, total.palin, total.palin_outer);
+  nonpalin.resize(2 * n, total.nonpalin, total.nonpalin_outer);
+  nonpalin_r.resize(2 * n, total.nonpalin, total.nonpalin_outer);
+
+  run_threads(nr_threads, [&](size_t k) {
+    Counts c = counts[k];
+    for_each_dyck_word(n, range(k), range(k + 1), [&](size_t, dyck::integer w) {
+      dyck::integer const ww = reverse(w, 2 * n);
+      if (ww == w) {
+        c.palin_outer += set_dyck_word(palin, c.palin++, c.palin_outer, w, n);
+      } else if (w < ww) {
+        set_dyck_word(nonpalin_r, c.nonpalin, c.nonpalin_outer, ww, n);
+        c.nonpalin_outer
+            += set_dyck_word(nonpalin, c.nonpalin++, c.nonpalin_outer, w, n);
+      }
+    });
+    assert(c.palin == counts[k + 1].palin);
+    assert(c.nonpalin == counts[k + 1].nonpalin);
+  });
+}
+
+void init_dyck_words(SymmetricWords<WordStore>& words,
+                     size_t                     n,
+                     size_t                     nr_threads) {
+  init_dyck_words(words.palin, words.nonpalin, words.nonpalin_r, n, nr_threads);
+}
+
+// A piecewise linear model of the cost of the rows of a PairSpace. The rows
+// are split into pieces, and the mean cost of a pair (i, j), measured in
+// steps of the kernel plus 1, in each piece is estimated from a random sample
+// of pairs. The seed is fixed so that the model is the same in every run.
+
+class CostModel {
+ public:
+  static size_t const nr_pieces = 64;
+  static size_t const nr_samples = 1024;  // per piece
+
+  template <typename F>
+  CostModel(PairSpace const& space, F pair_steps)
+      : _nr_rows(space.nr_rows()), _pair_cost(), _nr_sampled(0) {
+    size_t const nr_pieces
+        = std::max(std::min(CostModel::nr_pieces, _nr_rows), (size_t) 1);
+    std::mt19937 gen(0x5eed);
+    for (size_t p = 0; p < nr_pieces; p++) {
+      size_t const first = piece_begin(p, nr_pieces);
+      size_t const last  = piece_begin(p + 1, nr_pieces);
+      size_t       steps = 0, nr = 0;
+      if (first < last) {
+        std::uniform_int_distribution<size_t> row(first, last - 1);
+        for (size_t k = 0; k < nr_samples; k++) {
+          size_t const i = row(gen);
+          if (space.row_begin(i) == space.row_end(i)) {
+            continue;  // for example, the last row of a TRIANGLE
+          }
+          size_t const j = std::uniform_int_distribution<size_t>(
+              space.row_begin(i), space.row_end(i) - 1)(gen);
+          steps += pair_steps(i, j) + 1;
+          nr++;
+        }
+      }
+      _pair_cost.push_back(nr == 0 ? 1 : static_cast<double>(steps) / nr);
+      _nr_sampled += nr;
+    }
+  }
+
+  // The estimated cost of comparing row i with one later row
+  double pair_cost(size_t i) const {
+    size_t const nr_pieces = _pair_cost.size();
+    double const x = (static_cast<double>(i) + 0.5) * nr_pieces / _nr_rows
+                     - 0.5;  // position relative to the midpoints of pieces
+    if (x <= 0) {
+      return _pair_cost[0];
+    } else if (x >= nr_pieces - 1) {
+      return _pair_cost[nr_pieces - 1];
+    }
+    size_t const p = static_cast<size_t>(x);
+    return _pair_cost[p] + (x - p) * (_pair_cost[p + 1] - _pair_cost[p]);
+  }
+
+  void print() const {
+    auto minmax = std::minmax_element(_pair_cost.begin(), _pair_cost.end());
+    std::cout << "Cost model: " << _pair_cost.size() << " pieces from "
+              << _nr_sampled << " sampled pairs, cost per pair in ["
+              << *minmax.first << ", " << *minmax.second << "]" << std::endl;
+    // the precision is not set on std::cout, which the threads of motzkin.cc
+    // can share, see LineBuffer in progress.h
+    std::ostringstream costs;
+    costs.precision(3);
+    for (auto const& x : _pair_cost) {
+      costs << x << " ";
+    }
+    std::cout << "Cost per pair by piece: " << costs.str() << std::endl;
+  }
+
+ private:
+  size_t piece_begin(size_t p, size_t nr_pieces) const {
+    return (p * _nr_rows) / nr_pieces;
+  }
+
+  size_t              _nr_rows;
+  std::vector<double> _pair_cost;
+  size_t              _nr_sampled;
+};
+
+// The imbalance of the loads or times in x, i.e. the amount by which the
+// maximum exceeds the mean, as a percentage of the mean
+double imbalance(std::vector<double> const& x) {
+  double const mean = std::accumulate(x.begin(), x.end(), 0.0) / x.size();
+  return (mean == 0 ? 0 : 100 * (*std::max_element(x.begin(), x.end()) - mean)
+                              / mean);
+}
+
+void print_imbalance(std::vector<double> const& predicted,
+                     std::vector<double> const& actual) {
+  std::cout << "Predicted imbalance = " << imbalance(predicted)
+            << "%, actual imbalance = " << imbalance(actual) << "%"
+            << std::endl;
+}
+
+template <typename P> class Engine {
+ public:
+  typedef typename P::words_type words_type;
+
+  Engine(P const&       policy,
+         Options const& options,
+         size_t         nr_threads,
+         Checkpoint&    checkpoint,
+         Shard const&   shard)
+      : _policy(policy),
+        _options(options),
+        _nr_threads(nr_threads),
+        _checkpoint(checkpoint),
+        _shard(shard),
+        _nr_pairs(0) {}
+
+  // The number of idempotents from the pairs of words, except for the pairs
+  // (i, i) if P::has_diagonal is false. The pairs of palindromic words, and of
+  // a word and its reverse, are their own reverses, and every other pair is
+  // counted together with its reverse.
+  uint128_t count(SymmetricWords<words_type>& words) {
+    shape_t const triangle = (P::has_diagonal ? TRIANGLE_DIAG : TRIANGLE);
+    std::vector<uint128_t> nr_idempotents(_nr_threads, 0);
+
+    words.replicate();
+    count_phase<false>("palindromic and palindromic",
+                       triangle,
+                       words.palin_numa,
+                       words.palin_numa,
+                       nr_idempotents);
+    count_phase<true>("non-palindromic and non-palindromic",
+                      triangle,
+                      words.nonpalin_numa,
+                      words.nonpalin_numa,
+                      nr_idempotents);
+    count_phase<true>("palindromic and non-palindromic",
+                      RECTANGLE,
+                      words.palin_numa,
+                      words.nonpalin_numa,
+                      nr_idempotents);
+    count_phase<true>(std::string("non-palindromics and their ")
+                          + P::reverses(),
+                      TRIANGLE_DIAG,
+                      words.nonpalin_numa,
+                      words.nonpalin_r_numa,
+                      nr_idempotents);
+    return std::accumulate(
+        nr_idempotents.begin(), nr_idempotents.end(), (uint128_t) 0);
+  }
+
+  // The streaming mode, see tiles.h, where every pair of distinct words is
+  // compared once, and so the symmetry is not used, and make_tile(words,
+  // begin, end) makes the words in positions [begin, end), see run_tiles.
+  // Every thread holds the words of two tiles, and so no more than
+  // Tiles::max_nr_threads threads are used, so that the tiles fit into the
+  // budget.
+  template <typename G>
+  uint128_t count_tiles(Tiles const& tiles, G&& make_tile) {
+    size_t const nr_threads = std::min(_nr_threads, Tiles::max_nr_threads);
+    if (_options.verbose && nr_threads < _nr_threads) {
+      std::cout << "Using " << nr_threads << " threads in the streaming mode"
+                << std::endl;
+    }
+    std::vector<uint128_t> nr_idempotents(nr_threads, 0);
+    P const&               policy   = _policy;
+    std::atomic<size_t>&   nr_pairs = _nr_pairs;
+    run_tiles<words_type>(
+        tiles,
+        nr_threads,
+        nr_idempotents,
+        _checkpoint,
+        _shard,
+        _options.verbose,
+        make_tile,
+        [&policy, &nr_pairs](words_type const& rows,
+                             words_type const& cols,
+                             bool              diagonal,
+                             size_t&           sum) {
+          // one update of the shared count per tile, rather than per row
+          nr_pairs += (diagonal ? rows.size() * (rows.size() - 1) / 2
+                                : rows.size() * cols.size());
+          for (size_t i = 0; i < rows.size(); i++) {
+            if (diagonal) {
+              if (P::has_diagonal) {
+                add_checked(sum, policy.template diagonal<false>(rows, i));
+              }
+              policy.template count<false>(
+                  rows, i, rows, i + 1, rows.size(), sum);
+            } else {
+              policy.template count<false>(rows, i, cols, 0, cols.size(), sum);
+            }
+          }
+        });
+    return std::accumulate(
+        nr_idempotents.begin(), nr_idempotents.end(), (uint128_t) 0);
+  }
+
+  // The number of pairs compared so far by this process
+  size_t nr_pairs() const {
+    return _nr_pairs;
+  }
+
+ private:
+  // Count the pairs in the PairSpace of the given shape of the words u and l,
+  // and add them to nr_idempotents. The pairs (i, i) of a TRIANGLE_DIAG are
+  // either the pairs of a word and itself, if u and l are the same, or the
+  // pairs of a word and its reverse, which are their own reverses. Every
+  // thread reads the copies of u and l on its own NUMA node.
+  template <bool REFLECT>
+  void count_phase(std::string const&            name,
+                   shape_t                       shape,
+                   Replicated<words_type> const& u_copies,
+                   Replicated<words_type> const& l_copies,
+                   std::vector<uint128_t>&       nr_idempotents) {
+    PairSpace const space(
+        shape, u_copies.master().size(), l_copies.master().size());
+    std::vector<double> predicted;
+    Blocks const        blocks = make_blocks<REFLECT>(
+        space,
+        u_copies.master(),
+        l_copies.master(),
+        predicted,
+        std::integral_constant<bool, P::has_cost_model>());
+    _nr_pairs += blocks.starts[blocks.last] - blocks.starts[blocks.first];
+    uint128_t const last = std::accumulate(
+        nr_idempotents.begin(), nr_idempotents.end(), (uint128_t) 0);
+
+    P const&            policy  = _policy;
+    std::vector<double> elapsed = run_pairs(
+        space,
+        blocks,
+        &l_copies,
+        _nr_threads,
+        nr_idempotents,
+        _checkpoint,
+        _options.verbose,
+        [shape, &policy, &u_copies, &l_copies](
+            size_t i, size_t j_begin, size_t j_end, size_t& sum) {
+          words_type const& u = u_copies.local();
+          words_type const& l = l_copies.local();
+          if (shape == TRIANGLE_DIAG && j_begin == i) {
+            if (&u_copies == &l_copies) {
+              add_checked(sum, policy.template diagonal<REFLECT>(u, i));
+            } else {
+              policy.template count<false>(u, i, l, i, i + 1, sum);
+            }
+            j_begin++;
+          }
+          policy.template count<REFLECT>(u, i, l, j_begin, j_end, sum);
+        });
+    if (_options.verbose) {
+      if (!predicted.empty()) {
+        print_imbalance(predicted, elapsed);
+      }
+      uint128_t const next = std::accumulate(
+          nr_idempotents.begin(), nr_idempotents.end(), (uint128_t) 0);
+      std::cout << "From comparison of " << name << ": " << next - last
+                << std::endl;
+    }
+  }
+
+  // Blocks with roughly equal numbers of pairs
+  template <bool REFLECT>
+  Blocks make_blocks(PairSpace const& space,
+                     words_type const&,
+                     words_type const&,
+                     std::vector<double>&,
+                     std::false_type) const {
+    return uniform_blocks(space, _shard);
+  }
+
+  // Blocks of roughly equal cost according to the model, split into
+  // _nr_threads contiguous ranges, the estimated cost of each range is put
+  // into predicted.
+  template <bool REFLECT>
+  Blocks make_blocks(PairSpace const&     space,
+                     words_type const&    u,
+                     words_type const&    l,
+                     std::vector<double>& predicted,
+                     std::true_type) const {
+    P const&        policy = _policy;
+    CostModel const model(space, [&policy, &u, &l](size_t i, size_t j) {
+      return policy.template steps<REFLECT>(u, i, l, j);
+    });
+    if (_options.verbose) {
+      model.print();
+    }
+    return weighted_blocks(space,
+                           [&model](size_t i) { return model.pair_cost(i); },
+                           _nr_threads,
+                           _shard,
+                           predicted);
+  }
+
+  P const             _policy;
+  Options const&      _options;
+  size_t const        _nr_threads;
+  Checkpoint&         _checkpoint;
+  Shard const&        _shard;
+  std::atomic<size_t> _nr_pairs;
+};
+
+#endif  // ENGINE_H_
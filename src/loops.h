@@ -0,0 +1,278 @@
+/*******************************************************************************
+
+ Copyright (C) 2016 James D. Mitchell
+
+ This work is licensed under a Creative Commons Attribution-ShareAlike 4.0
+ International License. See
+ http://creativecommons.org/licenses/by-sa/4.0/
+
+*******************************************************************************/
+
+#ifndef LOOPS_H_
+#define LOOPS_H_
+
+#include <vector>
+
+#include "dispatch.h"
+#include "uint128.h"
+#include "word_store.h"
+
+// The kernels which compare a pair of Dyck words u and l, in kauffman.cc.
+//
+// The number of idempotents from the pairs (u, l) and (l, u) of distinct Dyck
+// words is 2 times the product over the loops formed by the arcs of u and l of
+// nr_u * nr_l, where nr_u and nr_l are the numbers of outer positions of u and
+// l in the loop. This is invariant under reversing u and l.
+//
+// In the odd case, the loop which contains the extra point, at the last
+// position, is omitted from the product. Since reversing u and l reverses the
+// loops, the number from (reverse(u), reverse(l)) is the product omitting the
+// loop which contains position 0 instead.
+//
+// count_even and count_odd add multiplier times the number from the pairs
+// (dycks1[i], dycks2[j]) for j in [j_begin, j_end), and if REVERSE is true
+// from their reverses too. If LENGTH is not 0, then it is the length of the
+// words, see dispatch.h.
+
+// Most of the pairs contribute 0, because a loop has no outer position of u or
+// of l. The peaks of a word are the positions k matched to k + 1, and if u and
+// l have a peak k in common, then the arcs (k, k + 1) of u and l form a loop
+// on their own, whose only outer positions are k in u and in l, if any. So the
+// pair contributes 0 if a peak of one word is an inner peak, not an outer
+// position, of the other, except in the odd case for the loop which contains
+// the extra point, which is omitted. The masks of the peaks and inner peaks of
+// the words are kept apart from the letters, see KauffmanWords, so that the
+// kernels skip these pairs without reading the words j.
+//
+// The loops are found one at a time, starting from the lowest position which
+// is not in any of the loops found so far. The positions of the loops found
+// so far are kept in a mask, so that the next start is its lowest zero bit.
+
+// All the positions of words of the given length
+inline word_mask_t all_positions(size_t length) {
+  return ~static_cast<word_mask_t>(0) >> (WordStore::max_length - length);
+}
+
+// Dyck words, and the masks of their peaks and inner peaks, see index_peaks.
+// A store without the masks of its peaks is not valid for the kernels.
+
+struct KauffmanWords {
+  size_t size() const {
+    return words.size();
+  }
+
+  size_t length() const {
+    return words.length();
+  }
+
+  size_t memory() const {
+    return words.memory()
+           + (peaks.size() + inner_peaks.size()) * sizeof(word_mask_t);
+  }
+
+  void prefetch(size_t begin, size_t end) const {
+    words.prefetch(begin, end);
+  }
+
+  void clear() {
+    words.clear();
+    std::vector<word_mask_t>().swap(peaks);
+    std::vector<word_mask_t>().swap(inner_peaks);
+  }
+
+  // See Replicated in numa.h
+  void copy(KauffmanWords const& other) {
+    words.copy(other.words);
+    peaks       = other.peaks;
+    inner_peaks = other.inner_peaks;
+  }
+
+  WordStore                words;
+  std::vector<word_mask_t> peaks;
+  std::vector<word_mask_t> inner_peaks;  // the peaks which are not outer
+};
+
+// Find the masks of the peaks and the inner peaks of the words in store
+
+void index_peaks(KauffmanWords& store) {
+  size_t const length = store.length();
+  store.peaks.assign(store.size(), 0);
+  store.inner_peaks.assign(store.size(), 0);
+  for (size_t i = 0; i < store.size(); i++) {
+    letter_t const* w     = store.words[i];
+    word_mask_t     peaks = 0;
+    for (size_t k = 0; k + 1 < length; k++) {
+      if (w[k] == k + 1) {
+        peaks |= bit(k);
+      }
+    }
+    store.peaks[i]       = peaks;
+    store.inner_peaks[i] = peaks & ~store.words.outer_mask(i);
+  }
+}
+
+template <bool REVERSE, size_t LENGTH = 0>
+void count_even(KauffmanWords const& dycks1,
+                size_t               i,
+                KauffmanWords const& dycks2,
+                size_t               j_begin,
+                size_t               j_end,
+                size_t               multiplier,
+                size_t&              nr_idempotents) {
+  word_mask_t const all     = all_positions(word_length<LENGTH>(dycks1));
+  letter_t const*   w_i     = dycks1.words[i];
+  word_mask_t const i_outer = dycks1.words.outer_mask(i);
+  word_mask_t const i_peaks = dycks1.peaks[i];
+  word_mask_t const i_inner = dycks1.inner_peaks[i];
+
+  for (size_t j = j_begin; j < j_end; j++) {
+    if ((i_peaks & dycks2.inner_peaks[j]) | (i_inner & dycks2.peaks[j])) {
+      continue;
+    }
+    letter_t const*   w_j     = dycks2.words[j];
+    word_mask_t const j_outer = dycks2.words.outer_mask(j);
+    word_mask_t       todo    = all;
+    size_t            cnt     = 1;
+    do {
+      size_t const start = lowest_bit(todo);
+      size_t       pos   = start;
+      word_mask_t  loop  = 0;  // the positions of the loop in the image of w_i
+      do {
+        loop |= bit(pos);
+        todo &= ~(bit(pos) | bit(w_j[pos]));
+        pos = w_i[w_j[pos]];
+      } while (pos != start);
+
+      size_t const nr_i = popcount(loop & i_outer);
+      size_t const nr_j = popcount(loop & j_outer);
+      if (nr_i == 0 || nr_j == 0) {
+        cnt = 0;
+        break;
+      }
+      cnt *= (nr_i * nr_j);
+    } while (todo != 0);
+    add_checked(nr_idempotents, (REVERSE ? 2 : 1) * multiplier * (2 * cnt));
+  }
+}
+
+template <bool REVERSE, size_t LENGTH = 0>
+void count_odd(KauffmanWords const& dycks1,
+               size_t               i,
+               KauffmanWords const& dycks2,
+               size_t               j_begin,
+               size_t               j_end,
+               size_t               multiplier,
+               size_t&              nr_idempotents) {
+  size_t const      length  = word_length<LENGTH>(dycks1);
+  word_mask_t const all     = all_positions(length);
+  letter_t const*   w_i     = dycks1.words[i];
+  word_mask_t const i_outer = dycks1.words.outer_mask(i);
+  // the peak length - 2 is matched to the extra point
+  word_mask_t const i_peaks = dycks1.peaks[i] & ~bit(length - 2);
+  word_mask_t const i_inner = dycks1.inner_peaks[i] & ~bit(length - 2);
+
+  for (size_t j = j_begin; j < j_end; j++) {
+    if ((i_peaks & dycks2.inner_peaks[j]) | (i_inner & dycks2.peaks[j])) {
+      continue;
+    }
+    letter_t const*   w_j     = dycks2.words[j];
+    word_mask_t const j_outer = dycks2.words.outer_mask(j);
+    word_mask_t       todo    = all;
+    // the products omitting the loops containing position 0 and the extra
+    // point, respectively
+    size_t not_first = 1, not_last = 1;
+
+    do {
+      size_t const start = lowest_bit(todo);
+      size_t       pos   = start;
+      word_mask_t  loop  = 0;
+      do {
+        loop |= bit(pos) | bit(w_j[pos]);
+        pos = w_i[w_j[pos]];
+      } while (pos != start);
+      todo &= ~loop;
+
+      size_t const nr = popcount(loop & i_outer) * popcount(loop & j_outer);
+      if (start != 0) {
+        not_first *= nr;
+      }
+      if (!((loop >> (length - 1)) & 1)) {
+        not_last *= nr;
+      }
+      if (not_last == 0 && (!REVERSE || not_first == 0)) {
+        break;
+      }
+    } while (todo != 0);
+    add_checked(nr_idempotents,
+                multiplier * 2 * (REVERSE ? not_first + not_last : not_last));
+  }
+}
+
+typedef void (*count_loops_t)(KauffmanWords const&,
+                              size_t,
+                              KauffmanWords const&,
+                              size_t,
+                              size_t,
+                              size_t,
+                              size_t&);
+
+template <bool ODD, bool REVERSE> struct CountLoops {
+  typedef count_loops_t type;
+
+  template <size_t LENGTH> static type get() {
+    return (ODD ? &count_odd<REVERSE, LENGTH> : &count_even<REVERSE, LENGTH>);
+  }
+};
+
+// The kernel for Dyck words of the given length, which is specialised for
+// every even length of the words of the degrees up to max_specialised_deg, see
+// dispatch.h.
+
+template <bool ODD, bool REVERSE>
+count_loops_t count_loops_kernel(size_t length) {
+  static std::vector<count_loops_t> const table
+      = dispatch_table<CountLoops<ODD, REVERSE>,
+                       2,
+                       2 * ((max_specialised_deg + 1) / 2),
+                       2>();
+  return dispatch(table, length);
+}
+
+// The kernel policy of kauffman.cc, see engine.h. The pairs (i, i) of a word
+// and itself contribute 1 in total, which kauffman.cc adds, and so they are
+// not counted by the engine.
+
+template <bool ODD> struct KauffmanPolicy {
+  typedef KauffmanWords words_type;
+
+  static bool const has_diagonal   = false;
+  static bool const has_cost_model = false;
+
+  static char const* reverses() {
+    return "reverses";
+  }
+
+  // The kernels for the words of the given length are chosen once, here
+  explicit KauffmanPolicy(size_t length)
+      : kernels{count_loops_kernel<ODD, false>(length),
+                count_loops_kernel<ODD, true>(length)} {}
+
+  template <bool REVERSE>
+  void count(KauffmanWords const& dycks1,
+             size_t               i,
+             KauffmanWords const& dycks2,
+             size_t               j_begin,
+             size_t               j_end,
+             size_t&              sum) const {
+    kernels[REVERSE](dycks1, i, dycks2, j_begin, j_end, 1, sum);
+  }
+
+  template <bool REVERSE>
+  size_t diagonal(KauffmanWords const&, size_t) const {
+    return 0;
+  }
+
+  count_loops_t kernels[2];  // without and with REVERSE
+};
+
+#endif  // LOOPS_H_
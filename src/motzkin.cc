@@ -26,36 +26,29 @@ On linux you might have to do:
 *******************************************************************************/
 
 #include <assert.h>
-#include <math.h>
 
 #include <algorithm>
 #include <cstdlib>
 #include <functional>
 #include <iostream>
-#include <mutex>
-#include <random>
-#include <stack>
+#include <sstream>
 #include <thread>
 #include <vector>
 
-#include "Dyck/dyck.h"
-#include "timer.h"
+#include "base.h"
+#include "engine.h"
+#include "motzkin.h"
+#include "tiles.h"
 
-typedef uint_fast8_t          letter_t;
-typedef std::vector<letter_t> motzkin_word_t;
-typedef size_t                index_t;
-typedef uint32_t              subset_t;
-typedef uint32_t              dyck_word_t;
+static Options    options;
+static size_t     nr_threads;  // see Options::threads
+static Checkpoint checkpoint;
+static Shard      shard;
 
-static const size_t nr_threads = std::thread::hardware_concurrency() - 2;
-static std::mutex   mtx;
-static bool         verbose;
-
-static std::vector<motzkin_word_t>    MOTZKIN_WORDS;
-static std::vector<motzkin_word_t>    MOTZKIN_OUTER;
-static std::vector<std::vector<bool>> MOTZKIN_BOOL;
-static std::vector<dyck_word_t>       DYCK_WORDS;
-static std::vector<subset_t>          SUBSETS;
+// The palindromic words, the non-palindromic words which are less than their
+// reflections, and their reflections, of even rank and of odd rank, see
+// init_motzkin and engine.h
+static SymmetricWords<MotzkinWords> MOTZKINS[2];
 
 static size_t const nr_motzkin_words_weight_0[] = {0,
                                                    1,
@@ -142,533 +135,454 @@ static size_t const nr_motzkin_words_weight_1[] = {0,
                                                    43423450867890548,
                                                    125769718187920320};
 
-void print_help_and_exit(char* name) {
-  std::cout << "usage: " << name << " [-h] [-v] n" << std::endl;
-  exit(0);
-}
-
-template <typename T> void print_vector(std::vector<T> const& v) {
-  for (auto it = v.begin(); it != v.end(); ++it) {
-    std::cout << *it << ", ";
-  }
-  std::cout << std::endl;
+// Call f(word, reflected, palin) for the Motzkin words in the positions
+// [begin, end) of the order of for_each_motzkin_word, which are palindromic, or
+// less than their reflections, where palin is true if the word is palindromic.
+// So every pair of a word and its reflection is visited once.
+
+template <typename F>
+void for_each_symmetric_word(size_t begin,
+                             size_t end,
+                             size_t length,
+                             size_t dyck_length_min,
+                             size_t set_size,
+                             std::function<size_t(size_t)> const& subset_size,
+                             F                                    f) {
+  letter_t reflected[WordStore::max_length];
+  for_each_motzkin_word(
+      begin,
+      end,
+      length,
+      dyck_length_min,
+      set_size,
+      subset_size,
+      [&](size_t, letter_t const* word) {
+        for (index_t j = 0; j < length; j++) {
+          reflected[j] = reflect(word[reflect(j, set_size)], set_size);
+        }
+        if (std::equal(word, word + length, reflected)) {
+          f(word, reflected, true);
+        } else if (std::lexicographical_compare(
+                       word, word + length, reflected, reflected + length)) {
+          f(word, reflected, false);
+        }
+      });
 }
 
-void init_motzkin(size_t                        nr_motzkin_words,
+// Put the Motzkin words in the positions [0, nr_motzkin_words) of the order of
+// for_each_motzkin_word into motzkins, so that every word is either
+// palindromic or is the i-th word in nonpalin or nonpalin_r, and its
+// reflection is the i-th word of the other one. As in init_dyck_words in
+// engine.h, every thread enumerates its own range of the words twice, first to
+// count the words and the outer positions of each kind, and then to put them
+// into the stores, which are allocated in between. So no memory is allocated
+// per word, and the words are in the same order for any number of threads.
+//
+// The odd rank words are ordered by their signatures, see index_signatures in
+// motzkin.h, and then in the order of for_each_motzkin_word. The words of
+// nonpalin_r are in the order of their reflections in nonpalin, and since the
+// reflection maps the signature s to set_size - 1 - s, their signatures are
+// in decreasing order.
+
+void init_motzkin(SymmetricWords<MotzkinWords>& motzkins,
+                  size_t                        nr_motzkin_words,
                   size_t                        motzkin_word_length,
                   size_t                        dyck_length_min,
-                  size_t                        dyck_length_max,
                   size_t                        set_size,
                   std::function<size_t(size_t)> subset_size) {
-  MOTZKIN_WORDS.clear();
-  MOTZKIN_WORDS.reserve(nr_motzkin_words);
-  MOTZKIN_OUTER.clear();
-  MOTZKIN_OUTER.reserve(nr_motzkin_words);
-  MOTZKIN_BOOL.clear();
-  MOTZKIN_BOOL.reserve(nr_motzkin_words);
-
-  index_t i = 0;
-
-  for (size_t m = dyck_length_min; m <= dyck_length_max; m++) {
-    DYCK_WORDS.clear();
-    SUBSETS.clear();
-    // Get Dyck words of length m
-    dyck::integer const end = dyck::maximum(m);
-    for (dyck::integer w = dyck::minimum(m); w <= end; w = dyck::next(w)) {
-      DYCK_WORDS.push_back(w);
-    }
-
-    size_t K = subset_size(m);
-    assert(K + 2 * m == motzkin_word_length);
-
-    if (K == 0) {
-      SUBSETS.push_back(0);
-    } else {
-      // Get subsets of {1 .. set_size} of size subset_size(m)
-      int s = (1 << K) - 1;
-      while (!(s & 1 << set_size)) {
-        SUBSETS.push_back(s);
-        int lo = s & ~(s - 1);   // lowest one bit
-        int lz = (s + lo) & ~s;  // lowest zero bit above lo
-        s |= lz;                 // add lz to the set
-        s &= ~(lz - 1);          // reset bits below lz
-        s |= (lz / lo / 2) - 1;  // put back right number of bits at end
-      }
+  MotzkinWords& PALIN      = motzkins.palin;
+  MotzkinWords& NONPALIN   = motzkins.nonpalin;
+  MotzkinWords& NONPALIN_R = motzkins.nonpalin_r;
+  bool const    odd_rank   = (motzkin_word_length > set_size);
+
+  // The words of the even rank are all in one bucket, and those of odd rank
+  // are in the bucket of their signature
+  size_t const nr_buckets = (odd_rank ? set_size : 1);
+  auto const   bucket     = [odd_rank, set_size](letter_t const* word) {
+    return (odd_rank ? static_cast<size_t>(word[set_size]) : 0);
+  };
+
+  // The numbers of palindromic and non-palindromic words, and of the outer
+  // positions of the words of each kind, in a bucket of a range, and then the
+  // positions of the first of these in the stores. Because of the extra point
+  // deg of the odd rank words, a word and its reflection can have different
+  // numbers of outer positions, see motzkin_outer.
+  struct Counts {
+    size_t palin;
+    size_t palin_outer;
+    size_t nonpalin;
+    size_t nonpalin_outer;
+    size_t nonpalin_r_outer;
+  };
+  // the bucket b of the range k is counts[k * nr_buckets + b]
+  std::vector<Counts> counts(nr_threads * nr_buckets, Counts());
+
+  auto const range = [nr_motzkin_words](size_t k) {
+    return (k * nr_motzkin_words) / nr_threads;
+  };
+
+  run_threads(nr_threads, [&](size_t k) {
+    Counts*  c = &counts[k * nr_buckets];
+    letter_t outer[WordStore::max_length];
+    for_each_symmetric_word(
+        range(k),
+        range(k + 1),
+        motzkin_word_length,
+        dyck_length_min,
+        set_size,
+        subset_size,
+        [&](letter_t const* word, letter_t const* reflected, bool palin) {
+          Counts& b = c[bucket(word)];
+          if (palin) {
+            b.palin++;
+            b.palin_outer += motzkin_outer(word, set_size, outer);
+          } else {
+            b.nonpalin++;
+            b.nonpalin_outer += motzkin_outer(word, set_size, outer);
+            b.nonpalin_r_outer += motzkin_outer(reflected, set_size, outer);
+          }
+        });
+  });
+
+  // the buckets in order, and the ranges in order within every bucket
+  Counts total = Counts();
+  for (size_t b = 0; b < nr_buckets; b++) {
+    for (size_t k = 0; k < nr_threads; k++) {
+      Counts&      c    = counts[k * nr_buckets + b];
+      Counts const next = {total.palin + c.palin,
+                           total.palin_outer + c.palin_outer,
+                           total.nonpalin + c.nonpalin,
+                           total.nonpalin_outer + c.nonpalin_outer,
+                           total.nonpalin_r_outer + c.nonpalin_r_outer};
+      c     = total;
+      total = next;
     }
+  }
 
-    dyck::integer       mask_word;
-    dyck::integer       mask_subset;
-    std::stack<index_t> stack;
-
-    for (dyck_word_t const& w : DYCK_WORDS) {
-      for (subset_t const& s : SUBSETS) {
-        mask_word   = static_cast<dyck::integer>(1) << (2 * m - 1);
-        mask_subset = static_cast<dyck::integer>(1) << (set_size - 1);
-
-        MOTZKIN_WORDS.push_back(motzkin_word_t());
-        MOTZKIN_WORDS[i].resize(motzkin_word_length);
-
-        for (index_t j = 0; j < motzkin_word_length; j++, mask_subset >>= 1) {
-          if (mask_subset & s) {
-            MOTZKIN_WORDS[i][j] = j;
+  assert(total.palin + 2 * total.nonpalin == nr_motzkin_words);
+  PALIN.words.resize(motzkin_word_length, total.palin, total.palin_outer);
+  NONPALIN.words.resize(
+      motzkin_word_length, total.nonpalin, total.nonpalin_outer);
+  NONPALIN_R.words.resize(
+      motzkin_word_length, total.nonpalin, total.nonpalin_r_outer);
+  PALIN.reflected_outer.assign(odd_rank ? total.palin : 0, 0);
+  NONPALIN.reflected_outer.assign(odd_rank ? total.nonpalin : 0, 0);
+  NONPALIN_R.reflected_outer.assign(odd_rank ? total.nonpalin : 0, 0);
+
+  run_threads(nr_threads, [&](size_t k) {
+    std::vector<Counts> c(counts.begin() + k * nr_buckets,
+                          counts.begin() + (k + 1) * nr_buckets);
+    for_each_symmetric_word(
+        range(k),
+        range(k + 1),
+        motzkin_word_length,
+        dyck_length_min,
+        set_size,
+        subset_size,
+        [&](letter_t const* word, letter_t const* reflected, bool palin) {
+          Counts& b = c[bucket(word)];
+          if (palin) {
+            size_t const i = b.palin++;
+            b.palin_outer
+                += set_motzkin_word(PALIN, i, b.palin_outer, word, set_size);
+            if (odd_rank) {
+              PALIN.reflected_outer[i]
+                  = reflect_mask(PALIN.words.outer_mask(i), set_size);
+            }
           } else {
-            if (mask_word & w) {
-              stack.push(j);
-            } else {
-              MOTZKIN_WORDS[i][j]           = stack.top();
-              MOTZKIN_WORDS[i][stack.top()] = j;
-              stack.pop();
+            size_t const i = b.nonpalin++;
+            b.nonpalin_outer += set_motzkin_word(
+                NONPALIN, i, b.nonpalin_outer, word, set_size);
+            b.nonpalin_r_outer += set_motzkin_word(
+                NONPALIN_R, i, b.nonpalin_r_outer, reflected, set_size);
+            if (odd_rank) {
+              NONPALIN.reflected_outer[i]
+                  = reflect_mask(NONPALIN_R.words.outer_mask(i), set_size);
+              NONPALIN_R.reflected_outer[i]
+                  = reflect_mask(NONPALIN.words.outer_mask(i), set_size);
             }
-            mask_word >>= 1;
           }
-        }
-        MOTZKIN_OUTER.push_back(motzkin_word_t());
-        MOTZKIN_BOOL.push_back(std::vector<bool>(motzkin_word_length, false));
-        for (index_t j = 0; j < set_size; j = MOTZKIN_WORDS[i][j], j++) {
-          if (j != MOTZKIN_WORDS[i][j] && MOTZKIN_WORDS[i][j] < set_size) {
-            MOTZKIN_OUTER[i].push_back(j);
-            MOTZKIN_BOOL[i][j] = true;
-          }
-        }
-        i++;
-      }
+        });
+  });
+
+  if (odd_rank) {
+    for (MotzkinWords* store : {&PALIN, &NONPALIN, &NONPALIN_R}) {
+      index_signatures(*store, set_size);
     }
   }
 }
 
-void print_mem_usage(Timer& timer) {
+void print_mem_usage(SymmetricWords<MotzkinWords> const& motzkins,
+                     Timer&                              timer) {
   timer.print();
   std::cout << std::endl;
 
-  double mem = 0;
-
-  for (auto const& x : MOTZKIN_OUTER) {
-    mem += (x.size() * sizeof(letter_t));
-  }
-  size_t len = MOTZKIN_WORDS.at(0).size();
-
-  mem += (MOTZKIN_WORDS.size() * sizeof(letter_t) * len);
-  mem += (MOTZKIN_WORDS.size() * sizeof(bool) * len);
-
-  std::string suf;
-  if (mem > 1073741824) {  // 1024 ^ 3
-    mem = mem / 1073741824;
-    suf = " GB";
-  } else if (mem > 1048576) {  // 1024 ^ 2
-    mem = mem / 1048576;
-    suf = " MB";
-  } else if (mem > 1024) {
-    mem = mem / 1024;
-    suf = " KB";
-  } else {
-    suf = " bytes";
-  }
-  std::cout << "Motzkin words use ~ " << mem << suf << std::endl;
+  std::cout << "Motzkin words use ~ " << string_mem(motzkins.memory())
+            << std::endl;
   std::cout << "Using " << nr_threads << " / "
             << std::thread::hardware_concurrency() << " threads" << std::endl;
+  print_numa_mode();
 }
 
-void distribute_to_threads_v1(std::vector<std::vector<index_t>>& unprocessed) {
-  size_t const nr_motzkin_words = MOTZKIN_WORDS.size();
-  size_t const av_load =
-      (nr_motzkin_words * (nr_motzkin_words - 1)) / (2 * nr_threads);
-  size_t thread_id   = 0;
-  size_t thread_load = 0;
-
-  for (size_t i = 0; i < nr_threads; i++) {
-    unprocessed.push_back(std::vector<index_t>());
-  }
+void print_nr_palindromes(SymmetricWords<MotzkinWords> const& motzkins) {
+  std::cout << "Number of palindromic Motzkin words is "
+            << motzkins.palin.size() << std::endl;
+  std::cout << "Number of non-palindromic Motzkin words is "
+            << 2 * motzkins.nonpalin.size() << std::endl;
+}
 
-  for (index_t i = 0; i < nr_motzkin_words; i++) {
-    unprocessed[thread_id].push_back(i);
-    thread_load += nr_motzkin_words - i - 1;
-    if (thread_load >= av_load && thread_id != nr_threads - 1) {
-      thread_id++;
-      thread_load = 0;
+// The fraction of all the pairs of odd rank words which the signature index
+// prunes, see index_signatures in motzkin.h
+
+void print_pruned_fraction(SymmetricWords<MotzkinWords> const& motzkins) {
+  MotzkinWords const* stores[]
+      = {&motzkins.palin, &motzkins.nonpalin, &motzkins.nonpalin_r};
+  double nr_pruned = 0;
+  double nr_pairs  = 0;
+  for (MotzkinWords const* u : stores) {
+    for (MotzkinWords const* l : stores) {
+      double const n = static_cast<double>(u->size()) * l->size();
+      nr_pruned += pruned_fraction(*u, *l) * n;
+      nr_pairs += n;
     }
   }
+  std::ostringstream percent;
+  percent.precision(3);
+  percent << (nr_pairs == 0 ? 0 : 100 * nr_pruned / nr_pairs);
+  std::cout << "The signature index prunes " << percent.str()
+            << "% of the pairs" << std::endl;
 }
 
-void distribute_to_threads_v2(std::vector<std::vector<index_t>>& unprocessed) {
-  size_t const nr_motzkin_words = MOTZKIN_WORDS.size();
-  size_t const av_load =
-      (nr_motzkin_words * (nr_motzkin_words - 1)) / (2 * nr_threads);
-  std::vector<size_t> thread_load(nr_threads, 0);
-  std::vector<size_t> map;
-  map.reserve(nr_threads);
-  // map from random number to thread_id
-
-  for (size_t i = 0; i < nr_threads; i++) {
-    unprocessed.push_back(std::vector<index_t>());
-    map.push_back(i);
-  }
+// The memory used by the words of one rank, where there are nr_motzkin_words
+// words of the given length, with their copies on every NUMA node, see
+// Replicated, or at most the budget in the streaming mode, see count_rank and
+// Tiles::budget.
 
-  std::random_device              rd;
-  std::mt19937                    gen(rd());
-  std::uniform_int_distribution<> dis(0, nr_threads - 1);
-  size_t                          nr_threads_remaining = nr_threads;
-  index_t                         i;
-  for (i = 0; i < nr_motzkin_words && nr_threads_remaining > 1; i++) {
-    size_t thread_id = map[dis(gen)];
-    unprocessed[thread_id].push_back(i);
-    thread_load[thread_id] += nr_motzkin_words - i - 1;
-    if (thread_load[thread_id] >= av_load) {
-      nr_threads_remaining--;
-      dis = std::uniform_int_distribution<>(0, nr_threads_remaining - 1);
-      for (size_t j = thread_id; j < nr_threads - 1; j++) {
-        map[j] = map[j + 1];
-      }
-    }
-  }
-  size_t thread_id = map[0];
-  for (; i < nr_motzkin_words; i++) {
-    unprocessed[thread_id].push_back(i);
+size_t rank_memory(size_t nr_motzkin_words, size_t motzkin_word_length) {
+  size_t const word_memory = WordStore::word_memory(motzkin_word_length);
+  if (Tiles::required(nr_motzkin_words, word_memory, options.max_mem)) {
+    return Tiles::budget(options.max_mem);
   }
+  return nr_replicas() * nr_motzkin_words
+         * (word_memory + sizeof(word_mask_t));
 }
 
-void count_even_rank(size_t                      thread_id,
-                     size_t                      nr_motzkin_words,
-                     std::vector<index_t> const& unprocessed,
-                     size_t&                     nr_idempotents) {
-  Timer timer;
-  if (verbose) {
-    timer.start();
-  }
-  for (index_t i : unprocessed) {
-    nr_idempotents += pow(2, MOTZKIN_OUTER[i].size());
-    for (index_t j = i + 1; j < nr_motzkin_words; j++) {
-      size_t                         max = 0, cnt = 1;
-      motzkin_word_t::const_iterator it = MOTZKIN_OUTER[j].begin();
-      do {
-        while (*it < max) it++;
-
-        size_t pos  = *it;
-        size_t nr_i = 0, nr_j = 1;
-        bool   stop = false;
-
-        max = MOTZKIN_WORDS[j][pos];
-
-        if (MOTZKIN_BOOL[i][pos]) {
-          nr_i++;
-        }
-
-        pos = MOTZKIN_WORDS[j][pos];
-
-        if (pos == MOTZKIN_WORDS[i][pos]) {
-          continue;
-        }
-
-        pos = MOTZKIN_WORDS[i][pos];
-
-        while (*it != pos) {
-          if (MOTZKIN_BOOL[j][pos]) {
-            nr_j++;
-            if (MOTZKIN_WORDS[j][pos] > max) {
-              max = MOTZKIN_WORDS[j][pos];
-            }
-          } else if (MOTZKIN_BOOL[i][pos]) {
-            nr_i++;
-          }
-          // Check if we reached a fixed point
-          if (pos == MOTZKIN_WORDS[j][pos]) {
-            stop = true;
-            break;
-          }
-          pos = MOTZKIN_WORDS[j][pos];
-          if (pos == MOTZKIN_WORDS[i][pos]) {
-            stop = true;
-            break;
-          }
-          pos = MOTZKIN_WORDS[i][pos];
-        }
-        if (*it == pos) {
-          cnt *= (nr_i * nr_j + 1);
-        }
-      } while (max < MOTZKIN_OUTER[j].back());
-      nr_idempotents += (2 * cnt);
+// The number of idempotents of even or odd rank from the pairs of non-empty
+// Motzkin words, which are those in the positions [0, nr_motzkin_words) of the
+// order of for_each_motzkin_word, with the same arguments. The words are kept
+// in MOTZKINS[ODD], unless they would use more than the budget, in which case
+// the streaming mode is used, see tiles.h, and they are freed at the end.
+
+template <bool ODD>
+uint128_t count_rank(size_t                        deg,
+                     size_t                        nr_motzkin_words,
+                     size_t                        motzkin_word_length,
+                     size_t                        dyck_length_min,
+                     size_t                        set_size,
+                     std::function<size_t(size_t)> subset_size,
+                     Checkpoint&                   ckpt,
+                     Timer&                        timer) {
+  Engine<MotzkinPolicy<ODD>> engine(
+      MotzkinPolicy<ODD>(deg), options, nr_threads, ckpt, shard);
+  size_t const word_memory = WordStore::word_memory(motzkin_word_length);
+
+  if (Tiles::required(nr_motzkin_words, word_memory, options.max_mem)) {
+    Tiles const tiles(nr_motzkin_words, word_memory, options.max_mem);
+    if (options.verbose) {
+      std::cout << "Motzkin words would use ~ "
+                << string_mem(nr_motzkin_words * word_memory)
+                << ", more than the budget of "
+                << string_mem(Tiles::budget(options.max_mem)) << std::endl;
+      std::cout << "Using tiles of " << tiles.size() << " Motzkin words"
+                << std::endl;
     }
+    return engine.count_tiles(
+        tiles, [&](MotzkinWords& store, size_t begin, size_t end) {
+          letter_t word[WordStore::max_length];
+          store.words.reset(motzkin_word_length, end - begin);
+          for (size_t r = begin; r < end; r++) {
+            unrank_motzkin_word(r,
+                                motzkin_word_length,
+                                dyck_length_min,
+                                set_size,
+                                subset_size,
+                                word);
+            push_motzkin_word(store, word, set_size);
+          }
+        });
   }
-  if (verbose) {
-    mtx.lock();
-    std::cout << "Thread " << thread_id
-              << " is finished, elapsed time = " << timer.string() << std::endl;
 
-    mtx.unlock();
+  SymmetricWords<MotzkinWords>& motzkins = MOTZKINS[ODD];
+  if (options.verbose) {
+    std::cout << "Processing Motzkin words, elapsed time = ";
   }
+  init_motzkin(motzkins,
+               nr_motzkin_words,
+               motzkin_word_length,
+               dyck_length_min,
+               set_size,
+               subset_size);
+  if (options.verbose) {
+    print_mem_usage(motzkins, timer);
+    print_nr_palindromes(motzkins);
+    if (ODD) {
+      print_pruned_fraction(motzkins);
+    }
+  }
+  uint128_t const out = engine.count(motzkins);
+  motzkins.clear();
+  return out;
 }
 
-// count idempotents of rank 1
+// The number of even rank idempotents, including those of the empty Dyck
+// word, in the lane ckpt of the checkpoint
+
+uint128_t count_even_rank(size_t deg, Checkpoint& ckpt) {
+  size_t    nr_motzkin_words = nr_motzkin_words_weight_0[deg];
+  uint128_t nr_even_rank     = 0;
 
-void count_odd_rank(size_t                      thread_id,
-                    size_t                      nr_motzkin_words,
-                    size_t                      deg,
-                    std::vector<index_t> const& unprocessed,
-                    size_t&                     nr_idempotents) {
   Timer timer;
-  if (verbose) {
+  if (options.verbose) {
+    std::cout << "Counting even rank Motzkin idempotents . . ." << std::endl;
+    std::cout << "Number of weight 0 Motzkin words is " << nr_motzkin_words
+              << std::endl;
     timer.start();
   }
-  for (index_t const& i : unprocessed) {
-    nr_idempotents += pow(2, MOTZKIN_OUTER[i].size());
-
-    for (index_t j = i + 1; j < nr_motzkin_words; j++) {
-      // check if there are any idempotents corresponding to the Motzkin words
-      // i and j
-      size_t pos           = deg;
-      bool   no_idempotent = false;
-      do {
-        if (MOTZKIN_WORDS[i][pos] == pos) {
-          no_idempotent = true;
-          break;
-        }
-        pos = MOTZKIN_WORDS[i][pos];
-        if (MOTZKIN_WORDS[j][pos] == pos) {
-          no_idempotent = true;
-          break;
-        }
-        pos = MOTZKIN_WORDS[j][pos];
-      } while (pos != deg);
-
-      if (no_idempotent) {
-        continue;
-      } else if (MOTZKIN_OUTER[j].empty() || MOTZKIN_OUTER[i].empty()) {
-        nr_idempotents += 2;
-        continue;
-      }
-
-      size_t                         max = 0, cnt = 1;
-      motzkin_word_t::const_iterator it = MOTZKIN_OUTER[j].begin();
-      do {
-        while (*it < max) it++;
-        size_t pos  = *it;
-        size_t nr_i = (MOTZKIN_BOOL[i][pos] ? 1 : 0);
-        size_t nr_j = 1;
-        bool   stop = false;
-
-        pos = MOTZKIN_WORDS[j][pos];
-        max = pos;
-
-        if (pos != MOTZKIN_WORDS[i][pos]) {
-          pos = MOTZKIN_WORDS[i][pos];
-
-          while (*it != pos) {
-            if (MOTZKIN_BOOL[j][pos]) {
-              nr_j++;
-              if (MOTZKIN_WORDS[j][pos] > max) {
-                max = MOTZKIN_WORDS[j][pos];
-              }
-            } else if (MOTZKIN_BOOL[i][pos]) {
-              nr_i++;
-            }
-            // Check if we reached a fixed point
-            if (pos == MOTZKIN_WORDS[j][pos]) {
-              stop = true;
-              break;
-            }
-            pos = MOTZKIN_WORDS[j][pos];
-            if (pos == MOTZKIN_WORDS[i][pos] || pos == deg) {
-              stop = true;
-              break;
-            }
-            pos = MOTZKIN_WORDS[i][pos];
-          }
-          if (!stop) {
-            cnt *= (nr_i * nr_j + 1);
-          }
-        }
-      } while (max < MOTZKIN_OUTER[j].back() && it != MOTZKIN_OUTER[j].end());
-      nr_idempotents += (2 * cnt);
-    }
+  // number of idempotents corresponding to the empty Dyck word, these are
+  // only counted by the first shard
+  if (shard.is_first()) {
+    nr_even_rank += 2 * nr_motzkin_words - 1;
   }
-  if (verbose) {
-    mtx.lock();
-    std::cout << "Thread " << thread_id
-              << " is finished, elapsed time = " << timer.string() << std::endl;
+  // don't consider the Motzkin word corresponding to the empty Dyck word
+  nr_motzkin_words--;
 
-    mtx.unlock();
+  // the words of length deg with deg - 2m fixed points, and the other
+  // positions matched by a Dyck word of length 2m
+  auto subset_size = [deg](size_t m) { return deg - 2 * m; };
+
+  nr_even_rank += count_rank<false>(
+      deg, nr_motzkin_words, deg, 1, deg, subset_size, ckpt, timer);
+
+  if (options.verbose) {
+    std::cout << "There are " << nr_even_rank << " even rank idempotents, ";
+    std::cout << "elapsed time = ";
+    timer.print();
+    std::cout << std::endl;
   }
+  return nr_even_rank;
 }
 
-void verify() {
-  assert(MOTZKIN_OUTER.size() == MOTZKIN_WORDS.size());
-  assert(MOTZKIN_BOOL.size() == MOTZKIN_WORDS.size());
+// The number of odd rank idempotents, in the lane ckpt of the checkpoint
 
-  for (size_t i = 0; i < MOTZKIN_WORDS.size(); i++) {
-    assert((size_t) std::count(
-               MOTZKIN_BOOL[i].begin(), MOTZKIN_BOOL[i].end(), true)
-           == MOTZKIN_OUTER[i].size());
-    for (auto j : MOTZKIN_OUTER[i]) {
-      assert(MOTZKIN_WORDS[i][j] != j);
-    }
+uint128_t count_odd_rank(size_t deg, Checkpoint& ckpt) {
+  size_t const nr_motzkin_words = nr_motzkin_words_weight_1[deg];
+  Timer        timer;
+
+  if (options.verbose) {
+    std::cout << "Counting odd rank Motzkin idempotents . . ." << std::endl;
+    std::cout << "Number of weight 1 Motzkin words is " << nr_motzkin_words
+              << std::endl;
+    timer.start();
   }
+  // the words of length deg + 1 with deg + 1 - 2m fixed points in the first
+  // deg positions, and the other positions, including the extra point deg,
+  // matched by a Dyck word of length 2m
+  auto subset_size = [deg](size_t m) { return deg + 1 - 2 * m; };
+
+  uint128_t const nr_odd_rank = count_rank<true>(
+      deg, nr_motzkin_words, deg + 1, 1, deg, subset_size, ckpt, timer);
+
+  if (options.verbose) {
+    std::cout << "There are " << nr_odd_rank << " odd rank idempotents, ";
+    std::cout << "elapsed time = ";
+    timer.print();
+    std::cout << std::endl;
+  }
+  return nr_odd_rank;
 }
 
 int main(int argc, char* argv[]) {
-  // Not very robust parsing!
-  int64_t deg = 0;
-  verbose     = false;
-
-  while (--argc) {
-    if (argv[argc][0] == '-') {
-      const char* p = argv[argc];
-      while (*++p) {
-        switch (*p) {
-          case 'v':
-            verbose = true;
-            break;
-
-          case 'h':
-            print_help_and_exit(argv[0]);
-        }
-      }
-    } else {
-      char** end = nullptr;
-      deg        = strtol(argv[argc], end, 0);
-      if (deg <= 0 || deg > 40) {
-        std::cerr << argv[0] << ": invalid argument! " << std::endl
-                  << argv[0] << ": must be an integer in [1, 30]" << std::endl;
-        exit(-1);
-      }
-    }
-  }
+  parse_args(argc, argv, options, checkpoint, shard);
+  size_t const deg = options.deg;
 
-  if (deg == 0) {
+  if (!shard.manifests.empty()) {
+    shard.merge("motzkin", options.verbose);
+    exit(0);
+  } else if (deg == 0) {
     print_help_and_exit(argv[0]);
   } else if (deg == 1) {
-    std::cout << 2 << std::endl;
+    uint128_t const out = (shard.is_first() ? 2 : 0);
+    std::cout << out << std::endl;
+    shard.write_manifest("motzkin", deg, std::vector<uint128_t>(), out);
     exit(0);
   }
 
-  index_t n;
-  if ((deg / 2) * 2 == deg) {  // deg is even
-    n = deg / 2;  // input to dyck, half the length of the returned words
-  } else {
-    n = (deg - 1) / 2;
-  }
+  checkpoint.init("motzkin", deg, shard);
+  nr_threads = options.threads(nr_motzkin_words_weight_0[deg]);
 
   Timer gtimer;
   gtimer.start();
 
-  size_t nr_even_rank = 0;
-  size_t nr_odd_rank  = 0;
-
-  {  // Count even rank idempotents
-    size_t nr_motzkin_words = nr_motzkin_words_weight_0[deg];
-
-    Timer timer;
-    if (verbose) {
-      std::cout << "Counting even rank Motzkin idempotents . . ." << std::endl;
-      std::cout << "Number of weight 0 Motzkin words is " << nr_motzkin_words
-                << std::endl;
-      std::cout << "Processing Motzkin words, elapsed time = ";
-      timer.start();
-    }
-    // number of idempotents corresponding to the empty Dyck word
-    nr_even_rank += 2 * nr_motzkin_words - 1;
-    // don't consider the Motzkin word corresponding to the empty Dyck word
-    nr_motzkin_words--;
-
-    if ((deg / 2) * 2 == deg) {
-      auto subset_size = [n](size_t m) { return 2 * n - 2 * m; };
-
-      init_motzkin(nr_motzkin_words, 2 * n, 1, n, 2 * n, subset_size);
-    } else {
-      auto subset_size = [n](size_t m) { return 2 * n - 2 * m + 1; };
-
-      init_motzkin(nr_motzkin_words, 2 * n + 1, 1, n, 2 * n + 1, subset_size);
-    }
-
-    if (verbose) {
-      print_mem_usage(timer);
-    }
-
-    std::vector<std::vector<index_t>> unprocessed;
-    distribute_to_threads_v1(unprocessed);
-
-    std::vector<size_t>      nr_idempotents(nr_threads, 0);
-    std::vector<std::thread> threads;
-
-    for (size_t i = 0; i < nr_threads; i++) {
-      threads.push_back(std::thread(count_even_rank,
-                                    i,
-                                    nr_motzkin_words,
-                                    std::ref(unprocessed[i]),
-                                    std::ref(nr_idempotents[i])));
-    }
-
-    // corresponds to empty Dyck words and whole set as subset
-    for (size_t i = 0; i < nr_threads; i++) {
-      threads[i].join();
-      nr_even_rank += nr_idempotents[i];
-    }
-
-    if (verbose) {
-      std::cout << "There are " << nr_even_rank << " even rank idempotents, ";
-      std::cout << "elapsed time = ";
-      timer.print();
-      std::cout << std::endl;
-    }
-  }
-  {  // Count odd rank idempotents
-    size_t nr_motzkin_words = nr_motzkin_words_weight_1[deg];
-    Timer  timer;
-
-    if (verbose) {
-      std::cout << "Counting odd rank Motzkin idempotents . . ." << std::endl;
-      std::cout << "Number of weight 1 Motzkin words is " << nr_motzkin_words
+  uint128_t nr_even_rank = 0;
+  uint128_t nr_odd_rank  = 0;
+
+  // The even and odd rank idempotents are counted in the lanes 0 and 1 of the
+  // checkpoint, so that a checkpoint can be resumed whether or not they are
+  // counted at the same time. They are counted at the same time if there is
+  // more than one thread, and the words of both fit into the budget, see
+  // Tiles::budget. Then all their work runs on one pool of nr_threads
+  // workers, see WorkerPool, so that the odd rank words are made while the
+  // even rank pairs are compared, and the workers which are idle at the end
+  // of a phase of one rank take the blocks of the other. Only the threads
+  // which run count_even_rank and count_odd_rank, which wait for the pool
+  // most of the time, are added, and the lines of their output are kept
+  // apart, and prefixed with their rank, by a LineBuffer.
+  Checkpoint&  odd_checkpoint = checkpoint.lane(1);
+  size_t const memory
+      = rank_memory(nr_motzkin_words_weight_0[deg], deg)
+        + rank_memory(nr_motzkin_words_weight_1[deg], deg + 1);
+  size_t const budget     = Tiles::budget(options.max_mem);
+  bool const   concurrent = nr_threads > 1 && (budget == 0 || memory <= budget);
+
+  if (concurrent) {
+    if (options.verbose) {
+      std::cout << "Counting even and odd rank Motzkin idempotents "
+                << "concurrently, the words use ~ " << string_mem(memory)
                 << std::endl;
-      std::cout << "Processing Motzkin words, elapsed time = ";
-      timer.start();
-    }
-    if ((deg / 2) * 2 == deg) {
-      auto subset_size = [n](size_t m) { return 2 * n - 2 * m + 1; };
-
-      init_motzkin(nr_motzkin_words, 2 * n + 1, 1, n, 2 * n, subset_size);
-    } else {
-      auto subset_size = [n](size_t m) { return 2 * n - 2 * m + 2; };
-
-      init_motzkin(
-          nr_motzkin_words, 2 * n + 2, 1, n + 1, 2 * n + 1, subset_size);
     }
-
-    if (verbose) {
-      print_mem_usage(timer);
-    }
-
-    std::vector<std::vector<index_t>> unprocessed;
-    distribute_to_threads_v1(unprocessed);
-
-    std::vector<size_t>      nr_idempotents(nr_threads, 0);
-    std::vector<std::thread> threads;
-
-    for (size_t i = 0; i < nr_threads; i++) {
-      threads.push_back(std::thread(count_odd_rank,
-                                    i,
-                                    nr_motzkin_words,
-                                    deg,
-                                    std::ref(unprocessed[i]),
-                                    std::ref(nr_idempotents[i])));
-    }
-
-    // corresponds to empty Dyck words and whole set as subset
-    for (size_t i = 0; i < nr_threads; i++) {
-      threads[i].join();
-      nr_odd_rank += nr_idempotents[i];
-    }
-    if (verbose) {
-      std::cout << "There are " << nr_odd_rank << " odd rank idempotents, ";
-      std::cout << "elapsed time = ";
-      timer.print();
-      std::cout << std::endl;
+    LineBuffer lines(std::cout);
+    WorkerPool pool(nr_threads);
+    worker_pool() = &pool;
+    std::thread even([&]() {
+      output_prefix() = "even: ";
+      nr_even_rank    = count_even_rank(deg, checkpoint);
+    });
+    std::thread odd([&]() {
+      output_prefix() = "odd: ";
+      nr_odd_rank     = count_odd_rank(deg, odd_checkpoint);
+    });
+    even.join();
+    odd.join();
+    worker_pool() = nullptr;
+  } else {
+    if (options.verbose && nr_threads > 1) {
+      std::cout << "Counting even and odd rank Motzkin idempotents one after "
+                << "the other, since the words would use ~ "
+                << string_mem(memory) << std::endl;
     }
+    nr_even_rank = count_even_rank(deg, checkpoint);
+    nr_odd_rank  = count_odd_rank(deg, odd_checkpoint);
   }
 
-  if (verbose) {
+  if (options.verbose) {
     std::cout << "Total elapsed time = ";
     gtimer.print();
     std::cout << std::endl;
   }
 
   std::cout << nr_even_rank + nr_odd_rank << std::endl;
+  shard.write_manifest(
+      "motzkin", deg, checkpoint.phase_sums(), nr_even_rank + nr_odd_rank);
+  checkpoint.finish();
   exit(0);
 }
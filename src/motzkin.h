@@ -0,0 +1,595 @@
+/*******************************************************************************
+
+ Copyright (C) 2016 James D. Mitchell
+
+ This work is licensed under a Creative Commons Attribution-ShareAlike 4.0
+ International License. See
+ http://creativecommons.org/licenses/by-sa/4.0/
+
+*******************************************************************************/
+
+// The Motzkin words of motzkin.cc, the ranking of the Motzkin words, and the
+// kernels which compare pairs of them.
+
+#ifndef MOTZKIN_H_
+#define MOTZKIN_H_
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include "base.h"
+#include "dispatch.h"
+#include "tiles.h"
+#include "uint128.h"
+#include "word_store.h"
+
+typedef size_t      index_t;
+typedef word_mask_t subset_t;  // the fixed points, up to 40 for degree 40
+
+// Motzkin words, and the outer positions of their reflections, reflected back,
+// and the signature index, which are only used for odd rank, see odd_rank_pair
+// and index_signatures.
+
+struct MotzkinWords {
+  size_t size() const {
+    return words.size();
+  }
+
+  size_t length() const {
+    return words.length();
+  }
+
+  size_t memory() const {
+    return words.memory() + reflected_outer.size() * sizeof(word_mask_t)
+           + sig_begin.size() * sizeof(index_t)
+           + sig_point.size() * sizeof(letter_t);
+  }
+
+  void prefetch(size_t begin, size_t end) const {
+    words.prefetch(begin, end);
+  }
+
+  void clear() {
+    words.clear();
+    std::vector<word_mask_t>().swap(reflected_outer);
+    std::vector<index_t>().swap(sig_begin);
+    std::vector<letter_t>().swap(sig_point);
+  }
+
+  // See Replicated in numa.h
+  void copy(MotzkinWords const& other) {
+    words.copy(other.words);
+    reflected_outer = other.reflected_outer;
+    sig_begin       = other.sig_begin;
+    sig_point       = other.sig_point;
+  }
+
+  WordStore                words;
+  std::vector<word_mask_t> reflected_outer;
+  // The words [sig_begin[r], sig_begin[r + 1]) have the signature
+  // sig_point[r], or both are empty if there is no index
+  std::vector<index_t>  sig_begin;
+  std::vector<letter_t> sig_point;
+};
+
+// The reflection of a Motzkin word reverses the positions [0, set_size), and
+// fixes the extra point deg of the odd rank words, if any. It maps the cycles
+// of a pair of words to the cycles of the pair of their reflections.
+
+inline size_t reflect(size_t pos, size_t set_size) {
+  return (pos < set_size ? set_size - 1 - pos : pos);
+}
+
+word_mask_t reflect_mask(word_mask_t mask, size_t set_size) {
+  word_mask_t out = 0;
+  for (; mask != 0; mask &= mask - 1) {
+    out |= bit(reflect(lowest_bit(mask), set_size));
+  }
+  return out;
+}
+
+// The outer positions of the Motzkin word, which are those in [0, set_size)
+// which are matched to another position in [0, set_size), and are not nested
+// inside any other matched pair, before any position matched to the extra
+// point deg of the odd rank words. Returns the number of outer positions.
+
+size_t motzkin_outer(letter_t const* word, size_t set_size, letter_t* outer) {
+  size_t nr_outer = 0;
+  for (index_t j = 0; j < set_size; j = word[j], j++) {
+    if (j != word[j] && word[j] < set_size) {
+      outer[nr_outer++] = j;
+    }
+  }
+  return nr_outer;
+}
+
+void push_motzkin_word(MotzkinWords&   store,
+                       letter_t const* word,
+                       size_t          set_size) {
+  letter_t     outer[WordStore::max_length];
+  size_t const nr_outer = motzkin_outer(word, set_size, outer);
+  store.words.push_back(word);
+  for (size_t k = 0; k < nr_outer; k++) {
+    store.words.push_outer(outer[k]);
+  }
+}
+
+// Put the Motzkin word into position i of store, see WordStore::set. Returns
+// the number of outer positions.
+
+size_t set_motzkin_word(MotzkinWords&   store,
+                        size_t          i,
+                        size_t          outer_offset,
+                        letter_t const* word,
+                        size_t          set_size) {
+  letter_t     outer[WordStore::max_length];
+  size_t const nr_outer = motzkin_outer(word, set_size, outer);
+  store.words.set(i, outer_offset, word, outer, outer + nr_outer);
+  return nr_outer;
+}
+
+// The Motzkin word of the given length, whose fixed points are the positions
+// set_size - 1 - k for the bits k of s, and whose other positions are matched
+// as the brackets of the Dyck word w of length 2m.
+
+void make_motzkin_word(dyck::integer w,
+                       size_t        m,
+                       subset_t      s,
+                       size_t        motzkin_word_length,
+                       size_t        set_size,
+                       letter_t*     word) {
+  dyck::integer mask_word   = static_cast<dyck::integer>(1) << (2 * m - 1);
+  dyck::integer mask_subset = static_cast<dyck::integer>(1) << (set_size - 1);
+  letter_t      stack[WordStore::max_length];
+  size_t        depth = 0;
+
+  for (index_t j = 0; j < motzkin_word_length; j++, mask_subset >>= 1) {
+    if (mask_subset & s) {
+      word[j] = j;
+    } else {
+      if (mask_word & w) {
+        stack[depth++] = j;
+      } else {
+        depth--;
+        word[j]            = stack[depth];
+        word[stack[depth]] = j;
+      }
+      mask_word >>= 1;
+    }
+  }
+}
+
+// The subset of [0, set_size) of size k in position rank of these subsets in
+// increasing order as bit masks, see for_each_motzkin_word
+
+subset_t unrank_subset(size_t rank, size_t k, size_t set_size) {
+  subset_t s = 0;
+  for (size_t b = set_size; b-- > 0 && k > 0;) {
+    // the subsets which do not contain b come first
+    size_t const nr_without = binomial(b, k);
+    if (rank >= nr_without) {
+      rank -= nr_without;
+      s |= static_cast<subset_t>(1) << b;
+      k--;
+    }
+  }
+  return s;
+}
+
+// The next subset of the same size in increasing order as bit masks, s must
+// not be 0
+
+inline subset_t next_subset(subset_t s) {
+  subset_t const lo = s & ~(s - 1);   // lowest one bit
+  subset_t const lz = (s + lo) & ~s;  // lowest zero bit above lo
+  s |= lz;                            // add lz to the set
+  s &= ~(lz - 1);                     // reset bits below lz
+  return s | ((lz / lo / 2) - 1);     // put back right number of bits at end
+}
+
+// The Motzkin words are ordered by the length 2m of their Dyck words, for m
+// starting at dyck_length_min, then by their Dyck words in increasing order,
+// and then by their subsets of fixed points of size subset_size(m) in
+// increasing order. So the position of the word with the Dyck word of rank d
+// and the subset of rank k is the number of words with shorter Dyck words plus
+// d * binomial(set_size, subset_size(m)) + k. This is the order of
+// init_motzkin in motzkin.cc.
+//
+// Call f(r, word) for the Motzkin words of the given length in positions r in
+// [begin, end) of this order, so that every thread can enumerate its own range
+// of the words. Only the first word is unranked, and the others are found by
+// dyck::next and next_subset.
+
+template <typename F>
+void for_each_motzkin_word(size_t begin,
+                           size_t end,
+                           size_t motzkin_word_length,
+                           size_t dyck_length_min,
+                           size_t set_size,
+                           std::function<size_t(size_t)> const& subset_size,
+                           F                                    f) {
+  if (begin >= end) {
+    return;
+  }
+  size_t m = dyck_length_min, rank = begin;
+  for (;; m++) {
+    size_t const nr = catalan_numbers[m] * binomial(set_size, subset_size(m));
+    if (rank < nr) {
+      break;
+    }
+    rank -= nr;
+  }
+  size_t        nr_subsets  = binomial(set_size, subset_size(m));
+  size_t        dyck_rank   = rank / nr_subsets;
+  size_t        subset_rank = rank % nr_subsets;
+  dyck::integer w           = unrank_dyck_word(dyck_rank, m);
+  subset_t      s = unrank_subset(subset_rank, subset_size(m), set_size);
+  letter_t      word[WordStore::max_length];
+
+  for (size_t r = begin;;) {
+    make_motzkin_word(w, m, s, motzkin_word_length, set_size, word);
+    f(r, static_cast<letter_t const*>(word));
+    if (++r == end) {
+      return;
+    }
+    if (++subset_rank < nr_subsets) {
+      s = next_subset(s);
+      continue;
+    }
+    subset_rank = 0;
+    if (++dyck_rank < catalan_numbers[m]) {
+      w = dyck::next(w);
+    } else {
+      m++;
+      nr_subsets = binomial(set_size, subset_size(m));
+      dyck_rank  = 0;
+      w          = dyck::minimum(m);
+    }
+    s = unrank_subset(0, subset_size(m), set_size);
+  }
+}
+
+// The Motzkin word in position rank of the order of for_each_motzkin_word,
+// with the same arguments, which is used by the streaming mode, see tiles.h
+
+void unrank_motzkin_word(size_t rank,
+                         size_t motzkin_word_length,
+                         size_t dyck_length_min,
+                         size_t set_size,
+                         std::function<size_t(size_t)> const& subset_size,
+                         letter_t*                            word) {
+  for_each_motzkin_word(rank,
+                        rank + 1,
+                        motzkin_word_length,
+                        dyck_length_min,
+                        set_size,
+                        subset_size,
+                        [word, motzkin_word_length](size_t, letter_t const* w) {
+                          std::copy(w, w + motzkin_word_length, word);
+                        });
+}
+
+// The contribution of the pair of the i-th word of u and the j-th word of l.
+// If COUNT is true, then steps is incremented for every step of the walks,
+// this is used to measure the cost of a pair in the cost model of motzkin.cc.
+//
+// Every cycle of alternately applying j and i which starts at an outer
+// position of j, and which does not reach a fixed point, contributes a factor
+// nr_i * nr_j + 1, where nr_i and nr_j are the numbers of outer positions of i
+// and j in the cycle. The positions visited from a start are collected in a
+// mask, so that nr_i and nr_j are popcounts, and the next start is the lowest
+// outer position of j which has not been visited.
+//
+// The contribution of a pair of even rank words is the same as that of the
+// pair of their reflections.
+
+template <bool COUNT>
+inline size_t even_rank_pair(WordStore const& u,
+                             index_t          i,
+                             WordStore const& l,
+                             index_t          j,
+                             size_t&          steps) {
+  letter_t const*   w_i     = u[i];
+  letter_t const*   w_j     = l[j];
+  word_mask_t const i_outer = u.outer_mask(i);
+  word_mask_t const j_outer = l.outer_mask(j);
+  word_mask_t const i_fixed = u.fixed_mask(i);
+  word_mask_t const j_fixed = l.fixed_mask(j);
+  word_mask_t       todo    = j_outer;
+  size_t            cnt     = 1;
+
+  while (todo != 0) {
+    size_t const start = lowest_bit(todo);
+    size_t       pos   = start;
+    word_mask_t  cycle = 0;
+    do {
+      if (COUNT) {
+        steps++;
+      }
+      cycle |= bit(pos);
+      if (j_fixed & bit(pos)) {
+        break;
+      }
+      pos = w_j[pos];
+      if (i_fixed & bit(pos)) {
+        break;
+      }
+      pos = w_i[pos];
+    } while (pos != start);
+    if (pos == start) {
+      cnt *= (popcount(cycle & i_outer) * popcount(cycle & j_outer) + 1);
+    }
+    todo &= ~cycle;
+  }
+  return 2 * cnt;
+}
+
+// As even_rank_pair, but the walks also stop at deg. If REFLECT is true, then
+// the contribution of the pair of the reflections of the words is added. This
+// is not the same as that of the words, since the reflection fixes deg, but
+// the cycles of the reflections are the reflections of the cycles of the
+// words. So it is computed in the same walks, from the outer positions of the
+// reflections, reflected back. If DEG is not 0, then it is deg, see
+// dispatch.h.
+
+template <bool COUNT, bool REFLECT, size_t DEG = 0>
+inline size_t odd_rank_pair(MotzkinWords const& u,
+                            index_t             i,
+                            MotzkinWords const& l,
+                            index_t             j,
+                            size_t              deg,
+                            size_t&             steps) {
+  assert(DEG == 0 || DEG == deg);
+  if (DEG != 0) {
+    deg = DEG;
+  }
+  letter_t const*   w_i     = u.words[i];
+  letter_t const*   w_j     = l.words[j];
+  word_mask_t const i_fixed = u.words.fixed_mask(i);
+  word_mask_t const j_fixed = l.words.fixed_mask(j);
+
+  // check if there are any idempotents corresponding to the Motzkin words
+  // i and j (or to their reflections)
+  size_t pos = deg;
+  do {
+    if (COUNT) {
+      steps++;
+    }
+    if (i_fixed & bit(pos)) {
+      return 0;
+    }
+    pos = w_i[pos];
+    if (j_fixed & bit(pos)) {
+      return 0;
+    }
+    pos = w_j[pos];
+  } while (pos != deg);
+
+  word_mask_t const i_outer   = u.words.outer_mask(i);
+  word_mask_t const j_outer   = l.words.outer_mask(j);
+  word_mask_t const i_reflect = (REFLECT ? u.reflected_outer[i] : 0);
+  word_mask_t const j_reflect = (REFLECT ? l.reflected_outer[j] : 0);
+  size_t            cnt = 1, cnt_reflect = 1;
+
+  // a cycle without outer positions of i contributes 1
+  word_mask_t todo
+      = (i_outer != 0 ? j_outer : 0) | (i_reflect != 0 ? j_reflect : 0);
+
+  while (todo != 0) {
+    size_t const start = lowest_bit(todo);
+    word_mask_t  cycle = 0;
+    pos                = start;
+    do {
+      if (COUNT) {
+        steps++;
+      }
+      cycle |= bit(pos);
+      if (j_fixed & bit(pos)) {
+        break;
+      }
+      pos = w_j[pos];
+      if ((i_fixed & bit(pos)) || pos == deg) {
+        break;
+      }
+      pos = w_i[pos];
+    } while (pos != start);
+    if (pos == start) {
+      cnt *= (popcount(cycle & i_outer) * popcount(cycle & j_outer) + 1);
+      if (REFLECT) {
+        cnt_reflect
+            *= (popcount(cycle & i_reflect) * popcount(cycle & j_reflect) + 1);
+      }
+    }
+    todo &= ~cycle;
+  }
+  return 2 * cnt + (REFLECT ? 2 * cnt_reflect : 0);
+}
+
+// The contribution of the pair of the i-th word of u and the j-th word of l,
+// and if REFLECT is true, then also of the pair of their reflections
+
+template <bool ODD, bool REFLECT, bool COUNT, size_t DEG = 0>
+inline size_t rank_pair(MotzkinWords const& u,
+                        index_t             i,
+                        MotzkinWords const& l,
+                        index_t             j,
+                        size_t              deg,
+                        size_t&             steps) {
+  if (ODD) {
+    return odd_rank_pair<COUNT, REFLECT, DEG>(u, i, l, j, deg, steps);
+  }
+  return (REFLECT ? 2 : 1)
+         * even_rank_pair<COUNT>(u.words, i, l.words, j, steps);
+}
+
+// The contribution of the pair (i, i) of the i-th word of u and itself, and if
+// REFLECT is true, then also of the pair of its reflection and itself
+
+template <bool ODD, bool REFLECT>
+size_t count_diagonal(MotzkinWords const& u, index_t i) {
+  size_t const nr_outer = u.words.nr_outer(i);
+  size_t const nr_reflect
+      = (ODD ? popcount(u.reflected_outer[i]) : nr_outer);
+  return (static_cast<size_t>(1) << nr_outer)
+         + (REFLECT ? static_cast<size_t>(1) << nr_reflect : 0);
+}
+
+// The signature of an odd rank word is the position matched to deg. The walk
+// from deg in odd_rank_pair passes through the signature of l[j], since it
+// returns to deg along the match of l[j], and so the pair contributes 0 if
+// the signature of l[j] is a fixed point of u[i]. index_signatures records
+// the runs of consecutive words with the same signature, which are long when
+// the words are ordered by their signatures, as init_motzkin in motzkin.cc
+// does, so that count_pairs can skip the runs of words which cannot
+// contribute with u[i] without reading them.
+
+void index_signatures(MotzkinWords& store, size_t deg) {
+  store.sig_begin.clear();
+  store.sig_point.clear();
+  for (index_t j = 0; j < store.size(); j++) {
+    letter_t const sig = store.words[j][deg];
+    if (j == 0 || sig != store.sig_point.back()) {
+      store.sig_begin.push_back(j);
+      store.sig_point.push_back(sig);
+    }
+  }
+  store.sig_begin.push_back(store.size());
+}
+
+// The fraction of the pairs of words in u and l which the signature index of
+// l prunes, see index_signatures
+
+double pruned_fraction(MotzkinWords const& u, MotzkinWords const& l) {
+  std::vector<size_t> nr_sig(WordStore::max_length, 0);
+  for (size_t r = 0; r + 1 < l.sig_begin.size(); r++) {
+    nr_sig[l.sig_point[r]] += l.sig_begin[r + 1] - l.sig_begin[r];
+  }
+  double nr_pruned = 0;
+  for (index_t i = 0; i < u.size(); i++) {
+    for (word_mask_t f = u.words.fixed_mask(i); f != 0; f &= f - 1) {
+      nr_pruned += nr_sig[lowest_bit(f)];
+    }
+  }
+  return (u.size() == 0 || l.size() == 0
+              ? 0
+              : nr_pruned / (static_cast<double>(u.size()) * l.size()));
+}
+
+template <bool ODD, bool REFLECT, size_t DEG = 0>
+void count_pairs(MotzkinWords const& u,
+                 index_t             i,
+                 MotzkinWords const& l,
+                 index_t             j_begin,
+                 index_t             j_end,
+                 size_t              deg,
+                 size_t&             nr_idempotents) {
+  size_t steps = 0;
+  if (ODD && !l.sig_begin.empty() && j_begin < j_end) {
+    word_mask_t const i_fixed = u.words.fixed_mask(i);
+    auto const        first   = l.sig_begin.begin();
+    size_t r = std::upper_bound(first, l.sig_begin.end(), j_begin) - first - 1;
+    for (index_t j = j_begin; j < j_end; r++) {
+      index_t const run_end = std::min(l.sig_begin[r + 1], j_end);
+      if (i_fixed & bit(l.sig_point[r])) {
+        j = run_end;
+        continue;
+      }
+      for (; j < run_end; j++) {
+        add_checked(
+            nr_idempotents,
+            rank_pair<ODD, REFLECT, false, DEG>(u, i, l, j, deg, steps));
+      }
+    }
+    return;
+  }
+  for (index_t j = j_begin; j < j_end; j++) {
+    add_checked(nr_idempotents,
+                rank_pair<ODD, REFLECT, false, DEG>(u, i, l, j, deg, steps));
+  }
+}
+
+typedef void (*count_pairs_t)(MotzkinWords const&,
+                              index_t,
+                              MotzkinWords const&,
+                              index_t,
+                              index_t,
+                              size_t,
+                              size_t&);
+
+// The walks of the even rank kernel do not depend on deg, and so only the odd
+// rank kernel is specialised.
+
+template <bool ODD, bool REFLECT> struct CountPairs {
+  typedef count_pairs_t type;
+
+  template <size_t DEG> static type get() {
+    return &count_pairs<ODD, REFLECT, (ODD ? DEG : 0)>;
+  }
+};
+
+// The kernel for the given degree, which is specialised for every degree up to
+// max_specialised_deg, see dispatch.h.
+
+template <bool ODD, bool REFLECT>
+count_pairs_t count_pairs_kernel(size_t deg) {
+  static std::vector<count_pairs_t> const table
+      = dispatch_table<CountPairs<ODD, REFLECT>, 1, max_specialised_deg>();
+  return dispatch(table, deg);
+}
+
+// The kernel policy of motzkin.cc, see engine.h. The cost of the pairs varies
+// a lot, and so the blocks are weighted by a cost model measured in steps of
+// the walks, see rank_pair.
+
+template <bool ODD> struct MotzkinPolicy {
+  typedef MotzkinWords words_type;
+
+  static bool const has_diagonal   = true;
+  static bool const has_cost_model = true;
+
+  static char const* reverses() {
+    return "reflections";
+  }
+
+  // The kernels for the degree are chosen once, here
+  explicit MotzkinPolicy(size_t deg)
+      : kernels{count_pairs_kernel<ODD, false>(deg),
+                count_pairs_kernel<ODD, true>(deg)},
+        deg(deg) {}
+
+  template <bool REFLECT>
+  void count(MotzkinWords const& u,
+             index_t             i,
+             MotzkinWords const& l,
+             index_t             j_begin,
+             index_t             j_end,
+             size_t&             sum) const {
+    kernels[REFLECT](u, i, l, j_begin, j_end, deg, sum);
+  }
+
+  template <bool REFLECT>
+  size_t diagonal(MotzkinWords const& u, index_t i) const {
+    return count_diagonal<ODD, REFLECT>(u, i);
+  }
+
+  template <bool REFLECT>
+  size_t steps(MotzkinWords const& u,
+               index_t             i,
+               MotzkinWords const& l,
+               index_t             j) const {
+    // the pairs pruned by the signature index are not compared at all
+    if (ODD && !l.sig_begin.empty()
+        && (u.words.fixed_mask(i) & bit(l.words[j][deg]))) {
+      return 0;
+    }
+    size_t nr_steps = 0;
+    rank_pair<ODD, REFLECT, true>(u, i, l, j, deg, nr_steps);
+    return nr_steps;
+  }
+
+  count_pairs_t kernels[2];  // without and with REFLECT
+  size_t        deg;
+};
+
+#endif  // MOTZKIN_H_
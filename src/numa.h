@@ -0,0 +1,281 @@
+/*******************************************************************************
+
+ Copyright (C) 2016 James D. Mitchell
+
+ This work is licensed under a Creative Commons Attribution-ShareAlike 4.0
+ International License. See
+ http://creativecommons.org/licenses/by-sa/4.0/
+
+*******************************************************************************/
+
+// The cores available to the program, and the pinning of the worker threads
+// of the Scheduler to them, see --pin.
+//
+// In the NUMA mode, --pin numa or --numa, on a machine with several NUMA
+// nodes, every worker thread is pinned to a core, with the threads dealt to
+// the nodes in turn, and the words are replicated on every node, see
+// Replicated, so that every thread reads the words in the memory of its own
+// node. Otherwise all the threads read one copy of the words, which is in the
+// memory of the node of the thread that made it.
+//
+// The nodes and their cores are read from sysfs, and if this is not possible
+// then there is one node with all the cores, and nothing is replicated.
+
+#ifndef NUMA_H_
+#define NUMA_H_
+
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum pin_t {
+  PIN_NONE,   // the threads are not pinned
+  PIN_CORES,  // every thread is pinned to one of the available cores
+  PIN_NUMA    // the threads are dealt to the NUMA nodes, see above
+};
+
+inline pin_t& pin_policy() {
+  static pin_t policy = PIN_NONE;
+  return policy;
+}
+
+inline bool numa_mode() {
+  return pin_policy() == PIN_NUMA;
+}
+
+// Parse a list of cores, such as 0-3,8-11, from sysfs
+inline std::vector<size_t> parse_cpu_list(std::string const& list) {
+  std::vector<size_t> cpus;
+  size_t              pos = 0;
+  while (pos < list.size()) {
+    size_t       end   = list.find(',', pos);
+    size_t const range = (end == std::string::npos ? list.size() : end);
+    std::string const item = list.substr(pos, range - pos);
+    size_t const      dash = item.find('-');
+    size_t const      lo   = std::stoul(item.substr(0, dash));
+    size_t const      hi
+        = (dash == std::string::npos ? lo : std::stoul(item.substr(dash + 1)));
+    for (size_t cpu = lo; cpu <= hi; cpu++) {
+      cpus.push_back(cpu);
+    }
+    pos = range + 1;
+  }
+  return cpus;
+}
+
+// The cores which the program may run on, which are fewer than the cores of
+// the machine if the program was started with taskset, or in a container
+// with a cpuset. This is read when it is first called, before any thread is
+// pinned.
+inline std::vector<size_t> const& available_cpus() {
+  static std::vector<size_t> const cpus = [] {
+    std::vector<size_t> cpus;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+      for (size_t cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &set)) {
+          cpus.push_back(cpu);
+        }
+      }
+    }
+#endif
+    if (cpus.empty()) {
+      for (size_t cpu = 0; cpu < std::thread::hardware_concurrency(); cpu++) {
+        cpus.push_back(cpu);
+      }
+    }
+    return cpus;
+  }();
+  return cpus;
+}
+
+// The number of cores allowed by the CPU quota of the cgroup of the program,
+// or 0 if there is no quota, rounded up. Both cgroup v2 (cpu.max) and v1
+// (cpu.cfs_quota_us and cpu.cfs_period_us) are supported.
+inline size_t cgroup_cpu_quota() {
+  std::string quota;
+  double      period = 0;
+  {
+    std::ifstream in("/sys/fs/cgroup/cpu.max");
+    in >> quota >> period;
+  }
+  if (quota.empty()) {
+    std::ifstream q("/sys/fs/cgroup/cpu/cpu.cfs_quota_us");
+    std::ifstream p("/sys/fs/cgroup/cpu/cpu.cfs_period_us");
+    q >> quota;
+    p >> period;
+  }
+  if (quota.empty() || quota == "max" || quota[0] == '-' || period <= 0) {
+    return 0;
+  }
+  return static_cast<size_t>(ceil(atof(quota.c_str()) / period));
+}
+
+// The physical memory of the machine in bytes, or 0 if it is not known
+inline size_t physical_memory() {
+#if defined(_SC_PHYS_PAGES) && defined(_SC_PAGE_SIZE)
+  long const pages = sysconf(_SC_PHYS_PAGES);
+  long const size  = sysconf(_SC_PAGE_SIZE);
+  if (pages > 0 && size > 0) {
+    return static_cast<size_t>(pages) * static_cast<size_t>(size);
+  }
+#endif
+  return 0;
+}
+
+// The default number of worker threads: one per available core, but no more
+// than the CPU quota, if any
+inline size_t default_nr_threads() {
+  size_t       nr    = available_cpus().size();
+  size_t const quota = cgroup_cpu_quota();
+  if (quota != 0) {
+    nr = std::min(nr, quota);
+  }
+  return std::max(nr, static_cast<size_t>(1));
+}
+
+// The available cores of every node
+inline std::vector<std::vector<size_t>> const& numa_nodes() {
+  static std::vector<std::vector<size_t>> const nodes = [] {
+    std::vector<size_t> const&       available = available_cpus();
+    std::vector<std::vector<size_t>> nodes;
+    for (size_t k = 0;; k++) {
+      std::ifstream in("/sys/devices/system/node/node" + std::to_string(k)
+                       + "/cpulist");
+      std::string list;
+      if (!(in >> list)) {
+        break;
+      }
+      std::vector<size_t> cpus;
+      for (size_t cpu : parse_cpu_list(list)) {
+        if (std::find(available.begin(), available.end(), cpu)
+            != available.end()) {
+          cpus.push_back(cpu);
+        }
+      }
+      if (!cpus.empty()) {
+        nodes.push_back(cpus);
+      }
+    }
+    if (nodes.empty()) {
+      nodes.push_back(available);
+    }
+    return nodes;
+  }();
+  return nodes;
+}
+
+// The node of the calling thread, 0 unless it was pinned
+inline size_t& numa_node() {
+  static thread_local size_t node = 0;
+  return node;
+}
+
+// Pin the calling thread to the given cores of the given node
+inline void numa_pin(size_t node, std::vector<size_t> const& cpus) {
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (size_t cpu : cpus) {
+    CPU_SET(cpu, &set);
+  }
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+  (void) cpus;
+#endif
+  numa_node() = node;
+}
+
+// Pin the calling thread, which is the worker thread_id, to a core, according
+// to pin_policy(). With PIN_CORES the workers are dealt to the available
+// cores in turn. With PIN_NUMA the workers are dealt to the nodes in turn,
+// and to the cores of a node in turn.
+inline void pin_worker(size_t thread_id) {
+  if (pin_policy() == PIN_CORES) {
+    auto const& cpus = available_cpus();
+    numa_pin(0, {cpus[thread_id % cpus.size()]});
+  } else if (pin_policy() == PIN_NUMA) {
+    auto const&  nodes = numa_nodes();
+    size_t const node  = thread_id % nodes.size();
+    size_t const k     = (thread_id / nodes.size()) % nodes[node].size();
+    numa_pin(node, {nodes[node][k]});
+  }
+}
+
+inline void print_numa_mode() {
+  if (numa_mode()) {
+    std::cout << "Using " << numa_nodes().size() << " NUMA nodes, with a copy "
+              << "of the words on each node" << std::endl;
+  }
+}
+
+// The number of copies of the words, including the master, which Replicated
+// makes in the current mode
+inline size_t nr_replicas() {
+  return (numa_mode() ? numa_nodes().size() : 1);
+}
+
+// Copies of the read-only object master on every node, which are made by
+// replicate in NUMA mode, where T::copy(T const&) makes a copy. Every copy is
+// made by a thread pinned to its node, so that its memory is on that node.
+// Before replicate is called, and if there are no copies, then local returns
+// master.
+
+template <typename T> class Replicated {
+ public:
+  explicit Replicated(T const& master) : _copies(), _master(master) {}
+
+  void replicate() {
+    _copies.clear();
+    auto const& nodes = numa_nodes();
+    if (!numa_mode() || nodes.size() == 1) {
+      return;
+    }
+    std::vector<std::thread> threads;
+    for (size_t node = 1; node < nodes.size(); node++) {
+      _copies.emplace_back(new T());
+      T* copy = _copies.back().get();
+      threads.emplace_back([this, copy, node, &nodes]() {
+        numa_pin(node, nodes[node]);
+        copy->copy(_master);
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+  }
+
+  // Free the copies
+  void clear() {
+    _copies.clear();
+  }
+
+  // The copy on the node of the calling thread
+  T const& local() const {
+    size_t const node = numa_node();
+    return (node == 0 || node > _copies.size() ? _master
+                                                : *_copies[node - 1]);
+  }
+
+  T const& master() const {
+    return _master;
+  }
+
+ private:
+  std::vector<std::unique_ptr<T>> _copies;  // on the nodes 1, 2, ...
+  T const&                        _master;  // on node 0
+};
+
+#endif  // NUMA_H_
@@ -0,0 +1,254 @@
+/*******************************************************************************
+
+ Copyright (C) 2016 James D. Mitchell
+
+ This work is licensed under a Creative Commons Attribution-ShareAlike 4.0
+ International License. See
+ http://creativecommons.org/licenses/by-sa/4.0/
+
+*******************************************************************************/
+
+// The progress of a phase, see run_pairs in scheduler.h. Every worker thread
+// records the number of pairs it has compared, the row it is comparing, and
+// the sum of the idempotents it has found, in its own cache line. A monitor
+// thread reads these and reports the percentage of the pairs compared, the
+// number of pairs compared per second, and the estimated time remaining, on
+// the standard error every progress_interval() seconds, see --progress, and
+// with the position of every thread when the program receives SIGUSR1.
+//
+// The lines of several threads which report at the same time are kept apart
+// by a LineBuffer.
+
+#ifndef PROGRESS_H_
+#define PROGRESS_H_
+
+#include <signal.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "timer.h"
+#include "uint128.h"
+
+// The number of seconds between reports, 0 means that progress is only
+// reported on SIGUSR1
+inline double& progress_interval() {
+  static double interval = 0;
+  return interval;
+}
+
+// The number of times SIGUSR1 was received. Every monitor reports when this
+// differs from the number it last saw, so that when there are several
+// monitors, such as those of the two ranks in motzkin.cc, all of them report.
+inline std::atomic<size_t>& progress_requests() {
+  static std::atomic<size_t> requests(0);
+  return requests;
+}
+
+extern "C" inline void progress_signal_handler(int) {
+  progress_requests()++;
+}
+
+// The prefix of the lines which the calling thread writes to std::cout while
+// a LineBuffer is installed, and of its reports of progress
+inline std::string& output_prefix() {
+  static thread_local std::string prefix;
+  return prefix;
+}
+
+// A stream buffer which is installed into std::cout, while several threads
+// report on computations which run at the same time, such as the even and
+// odd rank idempotents in motzkin.cc. The output of every thread is
+// collected into lines, and every complete line is written at once, after
+// the output_prefix() of the thread, so that the lines of the threads are not
+// interleaved.
+
+class LineBuffer : public std::streambuf {
+ public:
+  explicit LineBuffer(std::ostream& stream)
+      : _mtx(), _out(stream.rdbuf()), _stream(stream) {
+    _stream.rdbuf(this);
+  }
+
+  LineBuffer(LineBuffer const&) = delete;
+  LineBuffer& operator=(LineBuffer const&) = delete;
+
+  ~LineBuffer() {
+    _stream.rdbuf(_out);
+  }
+
+ protected:
+  int_type overflow(int_type c) override {
+    if (traits_type::eq_int_type(c, traits_type::eof())) {
+      return traits_type::not_eof(c);
+    }
+    std::string& line = this_line();
+    line.push_back(traits_type::to_char_type(c));
+    if (line.back() == '\n') {
+      std::lock_guard<std::mutex> lg(_mtx);
+      std::string const&          prefix = output_prefix();
+      _out->sputn(prefix.data(), prefix.size());
+      _out->sputn(line.data(), line.size());
+      line.clear();
+    }
+    return c;
+  }
+
+  std::streamsize xsputn(char const* s, std::streamsize n) override {
+    for (std::streamsize k = 0; k < n; k++) {
+      overflow(traits_type::to_int_type(s[k]));
+    }
+    return n;
+  }
+
+  int sync() override {
+    std::lock_guard<std::mutex> lg(_mtx);
+    return _out->pubsync();
+  }
+
+ private:
+  // The incomplete line of the calling thread
+  static std::string& this_line() {
+    static thread_local std::string line;
+    return line;
+  }
+
+  std::mutex      _mtx;
+  std::streambuf* _out;
+  std::ostream&   _stream;
+};
+
+// A time in seconds such as 3h 12m, 4m 10s, or 12s
+inline std::string string_time(double seconds) {
+  size_t const      s = static_cast<size_t>(seconds);
+  std::stringstream ss;
+  if (s >= 3600) {
+    ss << s / 3600 << "h " << (s % 3600) / 60 << "m";
+  } else if (s >= 60) {
+    ss << s / 60 << "m " << s % 60 << "s";
+  } else {
+    ss << s << "s";
+  }
+  return ss.str();
+}
+
+class Progress {
+ public:
+  // The state of one worker thread, which is only written by that thread.
+  // Padded to avoid false sharing.
+  struct Thread {
+    Thread() : pairs(0), row(0), sum(0) {}
+    std::atomic<size_t> pairs;  // compared in this run
+    std::atomic<size_t> row;    // the row i of the current segment
+    uint128_t           sum;    // only read once the thread is finished
+    char                pad[64];
+
+    // Record that the pairs (i, j) with j in [j_begin, j_end) were compared
+    void add(size_t i, size_t j_begin, size_t j_end) {
+      row.store(i, std::memory_order_relaxed);
+      pairs.store(pairs.load(std::memory_order_relaxed) + (j_end - j_begin),
+                  std::memory_order_relaxed);
+    }
+  };
+
+  // Starts the monitor of nr_threads threads comparing nr_pairs pairs, of
+  // which nr_skipped were compared in a previous run
+  Progress(size_t nr_threads, size_t nr_pairs, size_t nr_skipped)
+      : _cv(),
+        _finished(false),
+        _monitor(),
+        _mtx(),
+        _nr_pairs(nr_pairs),
+        _nr_skipped(nr_skipped),
+        _prefix(output_prefix()),
+        _threads(nr_threads),
+        _timer() {
+    _timer.start();
+    _monitor = std::thread([this]() { monitor(); });
+  }
+
+  ~Progress() {
+    {
+      std::lock_guard<std::mutex> lg(_mtx);
+      _finished = true;
+    }
+    _cv.notify_one();
+    _monitor.join();
+  }
+
+  Thread& thread(size_t thread_id) {
+    return _threads[thread_id];
+  }
+
+  // Print the progress to the standard error, and the position of every
+  // thread if details is true.
+  void report(bool details) const {
+    size_t pairs = 0;
+    for (auto const& t : _threads) {
+      pairs += t.pairs.load(std::memory_order_relaxed);
+    }
+    double const elapsed   = _timer.elapsed();
+    double const rate      = (elapsed > 0 ? pairs / elapsed : 0);
+    size_t const done      = std::min(pairs + _nr_skipped, _nr_pairs);
+    size_t const remaining = _nr_pairs - done;
+    std::stringstream ss;
+    ss << _prefix << "Progress: " << done << " / " << _nr_pairs << " pairs ("
+       << std::fixed << std::setprecision(1)
+       << (_nr_pairs == 0 ? 100 : (100.0 * done) / _nr_pairs) << "%), "
+       << static_cast<size_t>(rate) << " pairs per second, ETA "
+       << (rate > 0 ? string_time(remaining / rate) : "unknown") << "\n";
+    if (details) {
+      for (size_t k = 0; k < _threads.size(); k++) {
+        ss << _prefix << "  Thread " << k << " is at row "
+           << _threads[k].row.load(std::memory_order_relaxed) << ", "
+           << _threads[k].pairs.load(std::memory_order_relaxed)
+           << " pairs compared\n";
+      }
+    }
+    std::cerr << ss.str() << std::flush;
+  }
+
+ private:
+  // Wakes up every 100ms to check for SIGUSR1, and for the next report
+  void monitor() {
+    double                       next = progress_interval();
+    size_t                       seen = progress_requests();
+    std::unique_lock<std::mutex> lk(_mtx);
+    while (!_finished) {
+      _cv.wait_for(lk, std::chrono::milliseconds(100));
+      if (_finished) {
+        break;
+      }
+      size_t const requests = progress_requests();
+      if (requests != seen) {
+        seen = requests;
+        report(true);
+      } else if (next > 0 && _timer.elapsed() >= next) {
+        report(false);
+        next += progress_interval();
+      }
+    }
+  }
+
+  std::condition_variable _cv;
+  bool                    _finished;
+  std::thread             _monitor;
+  std::mutex              _mtx;
+  size_t const            _nr_pairs;
+  size_t const            _nr_skipped;
+  std::string const       _prefix;  // of the thread which made the Progress
+  std::vector<Thread>     _threads;
+  Timer                   _timer;
+};
+
+#endif  // PROGRESS_H_
@@ -0,0 +1,739 @@
+/*******************************************************************************
+
+ Copyright (C) 2016 James D. Mitchell
+
+ This work is licensed under a Creative Commons Attribution-ShareAlike 4.0
+ International License. See
+ http://creativecommons.org/licenses/by-sa/4.0/
+
+*******************************************************************************/
+
+#ifndef SCHEDULER_H_
+#define SCHEDULER_H_
+
+#include <assert.h>
+#include <math.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "checkpoint.h"
+#include "numa.h"
+#include "progress.h"
+#include "shard.h"
+#include "timer.h"
+#include "uint128.h"
+#include "word_store.h"
+
+// The pairs (i, j) of indices of words which are compared in one phase of the
+// computation. The pairs are ordered row by row, so that the pairs in any
+// range [first, last) of this order form a sequence of (i, j-range) segments.
+
+enum shape_t {
+  TRIANGLE,       // 0 <= i < j < nr_rows
+  TRIANGLE_DIAG,  // 0 <= i <= j < nr_rows
+  RECTANGLE       // 0 <= i < nr_rows, 0 <= j < nr_cols
+};
+
+class PairSpace {
+ public:
+  PairSpace(shape_t shape, size_t nr_rows, size_t nr_cols = 0)
+      : _shape(shape), _nr_rows(nr_rows), _nr_cols(nr_cols) {
+    // the positions of the pairs are 64-bit
+    uint128_t const n    = nr_rows;
+    uint128_t       size = n * nr_cols;
+    if (shape == TRIANGLE) {
+      size = (n == 0 ? 0 : n * (n - 1) / 2);
+    } else if (shape == TRIANGLE_DIAG) {
+      size = n * (n + 1) / 2;
+    }
+    if (size > static_cast<size_t>(-1)) {
+      std::cerr << "there are " << size << " pairs of words, more than fit "
+                << "in 64 bits" << std::endl;
+      exit(-1);
+    }
+  }
+
+  size_t nr_rows() const {
+    return _nr_rows;
+  }
+
+  // The first and one beyond the last value of j in row i
+  size_t row_begin(size_t i) const {
+    switch (_shape) {
+      case TRIANGLE:
+        return i + 1;
+      case TRIANGLE_DIAG:
+        return i;
+      default:
+        return 0;
+    }
+  }
+
+  size_t row_end(size_t i) const {
+    (void) i;
+    return (_shape == RECTANGLE ? _nr_cols : _nr_rows);
+  }
+
+  // The number of pairs in the rows before row i
+  size_t offset(size_t i) const {
+    switch (_shape) {
+      case TRIANGLE:
+        return half_product(i, 2 * _nr_rows - i - 1);
+      case TRIANGLE_DIAG:
+        return half_product(i, 2 * _nr_rows - i + 1);
+      default:
+        return i * _nr_cols;
+    }
+  }
+
+  size_t size() const {
+    return offset(_nr_rows);
+  }
+
+  // The row containing the pair in position p
+  size_t row(size_t p) const {
+    size_t i;
+    if (_shape == RECTANGLE) {
+      return p / _nr_cols;
+    }
+    // solve offset(i) = p for i, and then fix any rounding errors
+    double b = 2 * _nr_rows + (_shape == TRIANGLE ? -1.0 : 1.0);
+    double d = b * b - 8 * static_cast<double>(p);
+    i        = static_cast<size_t>((b - sqrt(d > 0 ? d : 0)) / 2);
+    i        = std::min(i, _nr_rows - 1);
+    while (i > 0 && offset(i) > p) {
+      i--;
+    }
+    while (i + 1 < _nr_rows && offset(i + 1) <= p) {
+      i++;
+    }
+    return i;
+  }
+
+  // Call f(i, j_begin, j_end) for every segment of a row in the pairs in
+  // positions [first, last)
+  template <typename F>
+  void for_each_segment(size_t first, size_t last, F&& f) const {
+    if (first >= last) {
+      return;
+    }
+    size_t i = row(first);
+    size_t j = row_begin(i) + (first - offset(i));
+    while (first < last) {
+      size_t end = std::min(row_end(i), j + (last - first));
+      if (j < end) {
+        f(i, j, end);
+        first += end - j;
+      }
+      i++;
+      j = row_begin(i);
+    }
+  }
+
+  // Call f(i, j_begin, j_end) for the same pairs as for_each_segment, but
+  // with the columns j split into tiles of tile columns, and with all the rows
+  // of the pairs visited for one tile before the next tile. So every row
+  // reads the words of the tile from the cache, rather than from memory. Before
+  // every row of a tile, prefetch(j_begin, j_end) is called for the next slice
+  // of the next tile, so that this is in the cache when it is reached.
+  template <typename F, typename P>
+  void for_each_tile(
+      size_t first, size_t last, size_t tile, F&& f, P&& prefetch) const {
+    if (first >= last) {
+      return;
+    }
+    size_t const i_first = row(first);
+    size_t const i_last  = row(last - 1);
+    // the columns of the pairs in row i
+    auto const columns = [this, first, last, i_first, i_last](
+                             size_t i, size_t& j_begin, size_t& j_end) {
+      j_begin = row_begin(i) + (i == i_first ? first - offset(i) : 0);
+      j_end   = (i == i_last ? row_begin(i) + (last - offset(i)) : row_end(i));
+    };
+    size_t j_min = row_end(i_first), j_max = 0;
+    for (size_t i = i_first; i <= i_last; i++) {
+      size_t j_begin, j_end;
+      columns(i, j_begin, j_end);
+      j_min = std::min(j_min, j_begin);
+      j_max = std::max(j_max, j_end);
+    }
+    size_t const nr_rows = i_last - i_first + 1;
+    for (size_t J = j_min; J < j_max; J += tile) {
+      size_t const J_end    = std::min(J + tile, j_max);
+      size_t const next_end = std::min(J_end + tile, j_max);
+      for (size_t i = i_first; i <= i_last; i++) {
+        size_t const k = i - i_first;
+        prefetch(J_end + ((next_end - J_end) * k) / nr_rows,
+                 J_end + ((next_end - J_end) * (k + 1)) / nr_rows);
+        size_t j_begin, j_end;
+        columns(i, j_begin, j_end);
+        j_begin = std::max(j_begin, J);
+        j_end   = std::min(j_end, J_end);
+        if (j_begin < j_end) {
+          f(i, j_begin, j_end);
+        }
+      }
+    }
+  }
+
+ private:
+  // a * b / 2, where one of a and b is even, and which is halved first so
+  // that it does not overflow if the result fits in 64 bits
+  static size_t half_product(size_t a, size_t b) {
+    return (a % 2 == 0 ? (a / 2) * b : a * (b / 2));
+  }
+
+  shape_t _shape;
+  size_t  _nr_rows;
+  size_t  _nr_cols;
+};
+
+// The policies of the Scheduler, see --scheduler
+enum sched_t {
+  SCHED_DYNAMIC,  // a global cursor, or seeds, and work stealing
+  SCHED_STATIC    // a static partition of the blocks and no stealing
+};
+
+inline sched_t& scheduler_policy() {
+  static sched_t policy = SCHED_DYNAMIC;
+  return policy;
+}
+
+inline char const* scheduler_name(sched_t policy) {
+  return (policy == SCHED_STATIC ? "static" : "dynamic");
+}
+
+// A pool of worker threads, which are pinned once when they start, see
+// pin_worker, and which run the jobs of several other threads at the same
+// time, see run. A job is a function step, where step(thread_id) does one
+// piece of the work of the job, such as a block of pairs, on the worker
+// thread_id, and returns false if there is no more work for that worker.
+// Every worker takes work from the oldest job which has work for it, so that
+// the workers which are idle at the end of one job, such as a phase of the
+// even rank idempotents in motzkin.cc, take work from the next one, such as a
+// phase of the odd rank idempotents.
+//
+// While worker_pool() is set, the Scheduler and run_threads in engine.h run
+// their work on the pool, rather than on threads of their own.
+
+class WorkerPool {
+  struct Job {
+    std::function<bool(size_t)> const* step;
+    std::vector<bool>                  finished;  // by the workers
+    size_t                             nr_finished;
+  };
+
+ public:
+  explicit WorkerPool(size_t nr_threads)
+      : _done(), _jobs(), _mtx(), _quit(false), _threads(), _wake() {
+    for (size_t i = 0; i < nr_threads; i++) {
+      _threads.emplace_back([this, i]() { work(i); });
+    }
+  }
+
+  WorkerPool(WorkerPool const&) = delete;
+  WorkerPool& operator=(WorkerPool const&) = delete;
+
+  ~WorkerPool() {
+    {
+      std::lock_guard<std::mutex> lg(_mtx);
+      _quit = true;
+    }
+    _wake.notify_all();
+    for (auto& thread : _threads) {
+      thread.join();
+    }
+  }
+
+  size_t size() const {
+    return _threads.size();
+  }
+
+  // Run the job step on the workers, and return once it has returned false
+  // on every worker. This must not be called by a worker.
+  void run(std::function<bool(size_t)> const& step) {
+    Job                          job = {&step, std::vector<bool>(size()), 0};
+    std::unique_lock<std::mutex> lk(_mtx);
+    _jobs.push_back(&job);
+    _wake.notify_all();
+    _done.wait(lk, [this, &job]() { return job.nr_finished == size(); });
+    _jobs.erase(std::find(_jobs.begin(), _jobs.end(), &job));
+  }
+
+ private:
+  void work(size_t thread_id) {
+    pin_worker(thread_id);
+    std::unique_lock<std::mutex> lk(_mtx);
+    while (true) {
+      Job* job = nullptr;
+      _wake.wait(lk, [this, thread_id, &job]() {
+        for (Job* j : _jobs) {
+          if (!j->finished[thread_id]) {
+            job = j;
+            return true;
+          }
+        }
+        return _quit;
+      });
+      if (job == nullptr) {
+        return;
+      }
+      lk.unlock();
+      bool const more = (*job->step)(thread_id);
+      lk.lock();
+      if (!more) {
+        job->finished[thread_id] = true;
+        if (++job->nr_finished == size()) {
+          _done.notify_all();
+        }
+      }
+    }
+  }
+
+  std::condition_variable  _done;
+  std::vector<Job*>        _jobs;  // the oldest first
+  std::mutex               _mtx;
+  bool                     _quit;
+  std::vector<std::thread> _threads;
+  std::condition_variable  _wake;
+};
+
+inline WorkerPool*& worker_pool() {
+  static WorkerPool* pool = nullptr;
+  return pool;
+}
+
+// A work-stealing executor for the blocks [first, last). Blocks are handed
+// out from an atomic global cursor in batches which shrink as the remaining
+// work shrinks. Each batch goes into the deque of the thread that took it,
+// and a thread whose deque is empty, once the cursor is exhausted, steals the
+// back half of the deque of another thread. So no thread is idle while there
+// are blocks remaining. Alternatively, the deques can be seeded with a static
+// partition of the blocks, in which case there is no global cursor.
+//
+// With the policy SCHED_STATIC there is no stealing, and if there are no
+// seeds, then thread i computes the i-th of nr_threads contiguous ranges of
+// the blocks. This is mostly useful for comparing with the default policy.
+//
+// If worker_pool() is set, then the blocks are computed by the workers
+// [0, nr_threads) of the pool, which must have at least nr_threads workers.
+
+class Scheduler {
+  // A deque of the contiguous blocks [lo, hi), the owner pops from the front
+  // and thieves take from the back. Padded to avoid false sharing.
+  struct Deque {
+    Deque() : mtx(), lo(0), hi(0) {}
+    std::mutex mtx;
+    size_t     lo;
+    size_t     hi;
+    char       pad[64];
+  };
+
+ public:
+  // If seeds is not empty, then thread i starts with the blocks
+  // [seeds[i], seeds[i + 1]). The threads stop taking new blocks once stop
+  // is true.
+  Scheduler(size_t                     nr_threads,
+            size_t                     first,
+            size_t                     last,
+            std::atomic<bool> const&   stop,
+            std::vector<size_t> const& seeds   = std::vector<size_t>(),
+            bool                       verbose = false,
+            sched_t                    policy  = SCHED_DYNAMIC)
+      : _cursor(seeds.empty() && policy == SCHED_DYNAMIC ? first : last),
+        _deques(nr_threads),
+        _elapsed(nr_threads, 0),
+        _last(last),
+        _nr_threads(nr_threads),
+        _steal(policy == SCHED_DYNAMIC),
+        _stop(stop),
+        _verbose(verbose) {
+    if (!seeds.empty()) {
+      assert(seeds.size() == nr_threads + 1 && seeds[0] == first
+             && seeds.back() == last);
+      for (size_t i = 0; i < nr_threads; i++) {
+        _deques[i].lo = seeds[i];
+        _deques[i].hi = seeds[i + 1];
+      }
+    } else if (policy == SCHED_STATIC) {
+      for (size_t i = 0; i < nr_threads; i++) {
+        _deques[i].lo = first + (i * (last - first)) / nr_threads;
+        _deques[i].hi = first + ((i + 1) * (last - first)) / nr_threads;
+      }
+    }
+  }
+
+  // Run f(thread_id, block) for every block in [first, last) on nr_threads
+  // threads, and return the time in seconds that each thread was running, or
+  // on the pool, the time that each worker spent on the blocks.
+  template <typename F> std::vector<double> const& run(F&& f) {
+    WorkerPool* pool = worker_pool();
+    if (pool != nullptr) {
+      assert(pool->size() >= _nr_threads);
+      std::vector<size_t> nr_blocks(_nr_threads, 0), nr_stolen(_nr_threads, 0);
+      pool->run([this, &f, &nr_blocks, &nr_stolen](size_t thread_id) {
+        if (thread_id >= _nr_threads) {
+          return false;
+        }
+        Timer timer;
+        timer.start();
+        bool const more = step(thread_id,
+                               f,
+                               nr_blocks[thread_id],
+                               nr_stolen[thread_id]);
+        _elapsed[thread_id] += timer.elapsed();
+        return more;
+      });
+      for (size_t i = 0; _verbose && i < _nr_threads; i++) {
+        std::cout << "Thread " << i << " is finished, busy for "
+                  << static_cast<size_t>(1000 * _elapsed[i]) << "ms ("
+                  << nr_blocks[i]
+                  << " blocks, " << nr_stolen[i] << " stolen)" << std::endl;
+      }
+      return _elapsed;
+    }
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < _nr_threads; i++) {
+      threads.push_back(std::thread([this, i, &f]() { work(i, f); }));
+    }
+    for (size_t i = 0; i < _nr_threads; i++) {
+      threads[i].join();
+    }
+    return _elapsed;
+  }
+
+ private:
+  template <typename F> void work(size_t thread_id, F& f) {
+    pin_worker(thread_id);
+    Timer timer;
+    timer.start();
+    size_t nr_blocks = 0, nr_stolen = 0;
+    while (step(thread_id, f, nr_blocks, nr_stolen)) {
+    }
+    _elapsed[thread_id] = timer.elapsed();
+    if (_verbose) {
+      std::lock_guard<std::mutex> lg(_mtx);
+      std::cout << "Thread " << thread_id << " is finished, elapsed time = "
+                << timer.string() << "(" << nr_blocks << " blocks, "
+                << nr_stolen << " stolen)" << std::endl;
+    }
+  }
+
+  // Compute the next block of the thread, if any, or return false if there
+  // are none
+  template <typename F>
+  bool step(size_t thread_id, F& f, size_t& nr_blocks, size_t& nr_stolen) {
+    size_t block;
+    bool   stolen;
+    if (_stop || !next(thread_id, block, stolen)) {
+      return false;
+    }
+    f(thread_id, block);
+    nr_blocks++;
+    nr_stolen += stolen;
+    return true;
+  }
+
+  bool next(size_t thread_id, size_t& block, bool& stolen) {
+    Deque& own = _deques[thread_id];
+    stolen     = false;
+    {
+      std::lock_guard<std::mutex> lg(own.mtx);
+      if (own.lo < own.hi) {
+        block = own.lo++;
+        return true;
+      }
+    }
+    // Take a batch from the global cursor
+    size_t first = _cursor.load();
+    while (first < _last) {
+      size_t batch = std::max((_last - first) / (2 * _nr_threads),
+                              static_cast<size_t>(1));
+      if (_cursor.compare_exchange_weak(first, first + batch)) {
+        std::lock_guard<std::mutex> lg(own.mtx);
+        own.lo = first + 1;
+        own.hi = first + batch;
+        block  = first;
+        return true;
+      }
+    }
+    // Steal the back half of some other thread's deque
+    for (size_t k = 1; _steal && k < _nr_threads; k++) {
+      Deque& victim = _deques[(thread_id + k) % _nr_threads];
+      size_t lo, hi;
+      {
+        std::lock_guard<std::mutex> lg(victim.mtx);
+        if (victim.lo == victim.hi) {
+          continue;
+        }
+        hi        = victim.hi;
+        lo        = victim.hi - (victim.hi - victim.lo + 1) / 2;
+        victim.hi = lo;
+      }
+      std::lock_guard<std::mutex> lg(own.mtx);
+      own.lo = lo + 1;
+      own.hi = hi;
+      block  = lo;
+      stolen = true;
+      return true;
+    }
+    return false;
+  }
+
+  std::atomic<size_t>      _cursor;
+  std::vector<Deque>       _deques;
+  std::vector<double>      _elapsed;
+  std::mutex               _mtx;
+  size_t const             _last;
+  size_t const             _nr_threads;
+  bool const               _steal;
+  std::atomic<bool> const& _stop;
+  bool const               _verbose;
+};
+
+// The blocks of a phase: block b consists of the pairs in positions
+// [starts[b], starts[b + 1]) of a PairSpace. Only the blocks [first, last)
+// are computed by this process, see Shard. If seeds is not empty, then it is
+// a static partition of these blocks for the Scheduler.
+//
+// The blocks only depend on the PairSpace (and the cost model, if any), and
+// on the minimum size of a block, which can be changed with --chunk, but not
+// on the number of threads or processes, so that a checkpoint written by a
+// run with one number of threads can be resumed with another, and so that
+// all the shards agree on the blocks.
+
+struct Blocks {
+  static size_t const max_nr_blocks = 65536;
+
+  // The minimum number of pairs in a block
+  static size_t& min_block_size() {
+    static size_t size = 1024;
+    return size;
+  }
+
+  Blocks() : starts(1, 0), seeds(), first(0), last(0) {}
+
+  size_t size() const {
+    return starts.size() - 1;
+  }
+
+  std::vector<size_t> starts;
+  std::vector<size_t> seeds;
+  size_t              first;
+  size_t              last;
+};
+
+// Blocks with roughly equal numbers of pairs, and at least min_block_size
+// pairs, if there are enough pairs
+
+Blocks uniform_blocks(PairSpace const& space,
+                      Shard const&     shard,
+                      size_t min_block_size = Blocks::min_block_size()) {
+  size_t const nr_pairs  = space.size();
+  size_t const nr_blocks = std::min(
+      Blocks::max_nr_blocks, (nr_pairs + min_block_size - 1) / min_block_size);
+  Blocks blocks;
+  for (size_t b = 1; b <= nr_blocks; b++) {
+    blocks.starts.push_back((nr_pairs / nr_blocks) * b
+                            + std::min(b, nr_pairs % nr_blocks));
+  }
+  blocks.first = shard.first(nr_blocks);
+  blocks.last  = shard.last(nr_blocks);
+  return blocks;
+}
+
+// Blocks with roughly equal estimated costs, where pair_cost(i) > 0 is the
+// cost of any pair in row i. The blocks of the shard are also split into
+// nr_threads contiguous ranges of roughly equal cost, and the estimated cost
+// of each of these ranges is put into predicted.
+
+template <typename F>
+Blocks weighted_blocks(PairSpace const&     space,
+                       F&&                  pair_cost,
+                       size_t               nr_threads,
+                       Shard const&         shard,
+                       std::vector<double>& predicted) {
+  size_t const nr_pairs  = space.size();
+  size_t const nr_blocks = std::min(
+      Blocks::max_nr_blocks,
+      (nr_pairs + Blocks::min_block_size() - 1) / Blocks::min_block_size());
+  double total = 0;
+  for (size_t i = 0; i < space.nr_rows(); i++) {
+    total += (space.row_end(i) - space.row_begin(i)) * pair_cost(i);
+  }
+  double const av_load = (nr_blocks == 0 ? 0 : total / nr_blocks);
+
+  Blocks blocks;
+  double cost = 0;  // the cost of the pairs before row i
+  for (size_t i = 0; i < space.nr_rows() && blocks.size() + 1 < nr_blocks;
+       i++) {
+    double const c   = pair_cost(i);
+    size_t const len = space.row_end(i) - space.row_begin(i);
+    // the block boundaries inside row i
+    while (blocks.size() + 1 < nr_blocks
+           && cost + len * c >= av_load * (blocks.size() + 1)) {
+      size_t pos = space.offset(i)
+                   + std::min(len,
+                              static_cast<size_t>(ceil(
+                                  (av_load * (blocks.size() + 1) - cost) / c)));
+      // every block must be non-empty
+      pos = std::max(pos, blocks.starts.back() + 1);
+      if (pos >= nr_pairs) {
+        break;
+      }
+      blocks.starts.push_back(pos);
+    }
+    cost += len * c;
+  }
+  if (nr_pairs > 0) {
+    blocks.starts.push_back(nr_pairs);
+  }
+
+  // The blocks have roughly equal costs, so they are split equally
+  blocks.first    = shard.first(blocks.size());
+  blocks.last     = shard.last(blocks.size());
+  size_t const nr = blocks.last - blocks.first;
+  predicted.assign(nr_threads, 0);
+  blocks.seeds.push_back(blocks.first);
+  for (size_t t = 0; t < nr_threads; t++) {
+    blocks.seeds.push_back(blocks.first + ((t + 1) * nr) / nr_threads);
+    predicted[t] = (blocks.seeds[t + 1] - blocks.seeds[t]) * av_load;
+  }
+  return blocks;
+}
+
+// The size in bytes of the cache that the columns of the blocks are tiled
+// for, see run_pairs. This is the L2 cache of the processor, if it can be
+// detected, and it can be changed with --cache.
+
+inline size_t cache_detect() {
+#ifdef _SC_LEVEL2_CACHE_SIZE
+  long const size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+  if (size > 0) {
+    return size;
+  }
+#endif
+  return 1 << 20;
+}
+
+inline size_t& cache_size() {
+  static size_t size = cache_detect();
+  return size;
+}
+
+// The number of columns in a tile of the words in columns, which uses half of
+// the cache, so that the other half is left for the words of the rows
+template <typename C> size_t tile_size(C const& columns) {
+  size_t const min_tile_size = 64;  // words
+  return std::max(cache_size() / (2 * WordStore::word_memory(columns.length())),
+                  min_tile_size);
+}
+
+// Compute f(i, j_begin, j_end, sum) for every segment of every block of
+// pairs in space, and add the sums to nr_idempotents[thread_id]. The sum of
+// every segment starts at 0 and has type R, which is 64 bits by default, so
+// that the kernels can add up the pairs of a row cheaply, and only the sums
+// of the segments are added in 128 bits, in the state of the thread in a
+// Progress, which is only added to nr_idempotents when the threads are
+// finished. Blocks finished in a previous run are skipped, and finished blocks
+// are recorded in the checkpoint. Returns the time in seconds that each
+// thread was running.
+//
+// If columns is not nullptr, then it holds the words j of the pairs, and the
+// blocks are visited in tiles of these words which fit in the cache, see
+// PairSpace::for_each_tile. Otherwise every row of a block is visited in
+// turn, and for a block of many long rows every row reads all the words j
+// from memory. The words, of type C, must have length() and prefetch(j_begin,
+// j_end) as WordStore does.
+
+template <typename R = size_t, typename C = WordStore, typename F>
+std::vector<double> run_pairs(PairSpace const&        space,
+                              Blocks const&           blocks,
+                              Replicated<C> const*    columns,
+                              size_t                  nr_threads,
+                              std::vector<uint128_t>& nr_idempotents,
+                              Checkpoint&             checkpoint,
+                              bool                    verbose,
+                              F&&                     f) {
+  if (checkpoint.begin_phase(blocks.size(), nr_idempotents)) {
+    if (verbose) {
+      std::cout << "Skipping phase finished in a previous run" << std::endl;
+    }
+    return std::vector<double>(nr_threads, 0);
+  }
+  size_t const tile = (columns == nullptr ? 0 : tile_size(columns->master()));
+  if (verbose) {
+    std::cout << "Using " << blocks.size() << " blocks of ~ "
+              << space.size() / std::max(blocks.size(), (size_t) 1)
+              << " pairs" << std::endl;
+    if (columns != nullptr) {
+      std::cout << "Using tiles of " << tile << " words" << std::endl;
+    }
+    if (blocks.last - blocks.first != blocks.size()) {
+      std::cout << "Computing the blocks [" << blocks.first << ", "
+                << blocks.last << ") of this shard" << std::endl;
+    }
+  }
+  size_t nr_skipped = 0;
+  for (size_t block = blocks.first; block < blocks.last; block++) {
+    if (checkpoint.is_done(block)) {
+      nr_skipped += blocks.starts[block + 1] - blocks.starts[block];
+    }
+  }
+  Progress progress(nr_threads,
+                    blocks.starts[blocks.last] - blocks.starts[blocks.first],
+                    nr_skipped);
+
+  std::vector<double> elapsed
+      = Scheduler(nr_threads,
+                  blocks.first,
+                  blocks.last,
+                  checkpoint.stop(),
+                  blocks.seeds,
+                  verbose,
+                  scheduler_policy())
+            .run([&](size_t thread_id, size_t block) {
+              if (checkpoint.is_done(block)) {
+                return;
+              }
+              Progress::Thread& state = progress.thread(thread_id);
+              uint128_t         sum   = 0;
+              auto const segment      = [&state, &sum, &f](
+                                       size_t i, size_t j_begin, size_t j_end) {
+                R row = 0;
+                f(i, j_begin, j_end, row);
+                sum += row;
+                state.add(i, j_begin, j_end);
+              };
+              if (columns == nullptr) {
+                space.for_each_segment(
+                    blocks.starts[block], blocks.starts[block + 1], segment);
+              } else {
+                space.for_each_tile(
+                    blocks.starts[block],
+                    blocks.starts[block + 1],
+                    tile,
+                    segment,
+                    [columns](size_t j_begin, size_t j_end) {
+                      columns->local().prefetch(j_begin, j_end);
+                    });
+              }
+              state.sum += sum;
+              checkpoint.complete(thread_id, block, sum);
+            });
+  for (size_t i = 0; i < nr_threads; i++) {
+    nr_idempotents[i] += progress.thread(i).sum;
+  }
+  checkpoint.end_phase();
+  return elapsed;
+}
+
+#endif  // SCHEDULER_H_
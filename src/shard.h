@@ -0,0 +1,166 @@
+/*******************************************************************************
+
+ Copyright (C) 2016 James D. Mitchell
+
+ This work is licensed under a Creative Commons Attribution-ShareAlike 4.0
+ International License. See
+ http://creativecommons.org/licenses/by-sa/4.0/
+
+*******************************************************************************/
+
+#ifndef SHARD_H_
+#define SHARD_H_
+
+#include <stdlib.h>
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "uint128.h"
+
+// A slice of the computation for one of several independent processes, which
+// might run on different machines. Every phase of the computation is split
+// into the same blocks in every process, see Blocks in scheduler.h, and the
+// blocks have roughly equal estimated costs. Shard k of N computes the k-th of
+// N contiguous ranges of the blocks of every phase, and the contributions
+// which do not come from any block are only counted by the first shard.
+//
+// Every shard writes a manifest containing its sums per phase and its total,
+// and --merge adds up the totals of the manifests of all the shards of a
+// computation.
+
+class Shard {
+ public:
+  Shard() : index(0), count(1), manifests() {}
+
+  // Settings, see parse_args in base.h
+  size_t                   index;      // 0 <= index < count
+  size_t                   count;      // the number of shards
+  std::vector<std::string> manifests;  // the manifests to merge
+
+  bool is_first() const {
+    return index == 0;
+  }
+
+  // The blocks [first, last) of a phase with nr_blocks blocks belong to this
+  // shard.
+  size_t first(size_t nr_blocks) const {
+    return (index * nr_blocks) / count;
+  }
+
+  size_t last(size_t nr_blocks) const {
+    return ((index + 1) * nr_blocks) / count;
+  }
+
+  // For example, "2/8" for the second of 8 shards
+  std::string string() const {
+    return std::to_string(index + 1) + "/" + std::to_string(count);
+  }
+
+  // The default name of a file belonging to this shard
+  std::string file(std::string const& program,
+                   size_t             degree,
+                   std::string const& ext) const {
+    std::string name = program + "-" + std::to_string(degree);
+    if (count > 1) {
+      name += "." + std::to_string(index + 1) + "-of-" + std::to_string(count);
+    }
+    return name + "." + ext;
+  }
+
+  // Write the manifest of this shard, if there is more than one shard.
+  void write_manifest(std::string const&            program,
+                      size_t                        degree,
+                      std::vector<uint128_t> const& phase_sums,
+                      uint128_t                     total) const {
+    if (count == 1) {
+      return;
+    }
+    std::string const name = file(program, degree, "manifest");
+    std::ofstream     out(name);
+    out << "program " << program << "\n";
+    out << "degree " << degree << "\n";
+    out << "shard " << index + 1 << " " << count << "\n";
+    out << "phases " << phase_sums.size();
+    for (auto const& x : phase_sums) {
+      out << " " << x;
+    }
+    out << "\ntotal " << total << "\n";
+    out.close();
+    if (!out) {
+      std::cerr << "shard: cannot write " << name << std::endl;
+      exit(-1);
+    }
+    std::cerr << "Shard " << string() << " written to " << name << std::endl;
+  }
+
+  // Check that the manifests are those of all the shards of one computation
+  // by program, and print the total.
+  void merge(std::string const& program, bool verbose) const {
+    size_t                 degree = 0, nr_shards = 0;
+    uint128_t              total = 0;
+    std::vector<bool>      seen;
+    std::vector<uint128_t> phase_sums;
+
+    for (auto const& name : manifests) {
+      std::ifstream          in(name);
+      std::string            key, prog;
+      size_t                 deg, k, n, nr;
+      uint128_t              sum = 0;
+      std::vector<uint128_t> sums;
+      in >> key >> prog >> key >> deg >> key >> k >> n >> key >> nr;
+      sums.resize(nr);
+      for (auto& x : sums) {
+        in >> x;
+      }
+      in >> key >> sum;
+      if (!in) {
+        error(name + " cannot be read");
+      } else if (prog != program) {
+        error(name + " is not a manifest of " + program);
+      } else if (seen.empty()) {
+        degree    = deg;
+        nr_shards = n;
+        seen.assign(n, false);
+        phase_sums.assign(nr, 0);
+      }
+      if (deg != degree || n != nr_shards || nr != phase_sums.size()) {
+        error(name + " is not from the same computation as "
+              + manifests[0]);
+      } else if (k == 0 || k > n) {
+        error(name + " has an invalid shard " + std::to_string(k));
+      } else if (seen[k - 1]) {
+        error(name + " repeats shard " + std::to_string(k));
+      }
+      seen[k - 1] = true;
+      for (size_t i = 0; i < nr; i++) {
+        phase_sums[i] += sums[i];
+      }
+      total += sum;
+    }
+    for (size_t k = 0; k < seen.size(); k++) {
+      if (!seen[k]) {
+        error("shard " + std::to_string(k + 1) + " of "
+              + std::to_string(nr_shards) + " is missing");
+      }
+    }
+    if (verbose) {
+      std::cout << "Merged " << nr_shards << " shards of " << program << " "
+                << degree << std::endl;
+      for (size_t i = 0; i < phase_sums.size(); i++) {
+        std::cout << "Phase " << i << ": " << phase_sums[i] << std::endl;
+      }
+    }
+    std::cout << total << std::endl;
+  }
+
+ private:
+  static void error(std::string const& msg) {
+    std::cerr << "merge: " << msg << std::endl;
+    exit(-1);
+  }
+};
+
+#endif  // SHARD_H_
@@ -0,0 +1,236 @@
+/*******************************************************************************
+
+ Copyright (C) 2016 James D. Mitchell
+
+ This work is licensed under a Creative Commons Attribution-ShareAlike 4.0
+ International License. See
+ http://creativecommons.org/licenses/by-sa/4.0/
+
+*******************************************************************************/
+
+// The streaming mode, which is used when the words would use more memory than
+// the budget given by --max-mem, or than the physical memory of the machine if
+// there is no --max-mem. The words are numbered, and the pairs (i, j)
+// with i <= j are compared in tiles: the pairs with i in the I-th range and j
+// in the J-th range of Tiles::size() consecutive words. Every thread only
+// holds the words of the two ranges of the tile it is comparing, and these
+// are made again for every tile from their numbers, by unranking. So the
+// memory used does not depend on the number of words, and the time spent
+// making the words is small compared to the time spent comparing them.
+//
+// The streaming mode compares every pair of distinct words once, and so it
+// does not use the symmetries which halve the number of pairs compared in the
+// other mode.
+
+#ifndef TILES_H_
+#define TILES_H_
+
+#include <algorithm>
+#include <vector>
+
+#include "base.h"
+#include "scheduler.h"
+
+// The binomial coefficient n choose k, for n <= WordStore::max_length
+
+inline size_t binomial(size_t n, size_t k) {
+  static std::vector<std::vector<size_t>> const pascal = [] {
+    std::vector<std::vector<size_t>> rows;
+    for (size_t m = 0; m <= WordStore::max_length; m++) {
+      rows.emplace_back(m + 1, 1);
+      for (size_t j = 1; j < m; j++) {
+        rows[m][j] = rows[m - 1][j - 1] + rows[m - 1][j];
+      }
+    }
+    return rows;
+  }();
+  return (k > n ? 0 : pascal[n][k]);
+}
+
+// The number of ways of completing a prefix of a Dyck word with r more
+// letters, when the prefix has h more opening than closing brackets
+
+inline size_t nr_dyck_suffixes(size_t r, size_t h) {
+  if (h > r || (r - h) % 2 == 1) {
+    return 0;
+  }
+  size_t const k = (r - h) / 2;
+  return binomial(r, k) - (k == 0 ? 0 : binomial(r, k - 1));
+}
+
+// The Dyck word of length 2n in position rank of the Dyck words of length 2n
+// in increasing order, i.e. the order of dyck::next
+
+dyck::integer unrank_dyck_word(size_t rank, size_t n) {
+  assert(rank < catalan_numbers[n]);
+  dyck::integer w = 0;
+  size_t        h = 0;
+  for (size_t p = 0; p < 2 * n; p++) {
+    // the words with a closing bracket in position p come first
+    size_t const nr_close
+        = (h == 0 ? 0 : nr_dyck_suffixes(2 * n - p - 1, h - 1));
+    w <<= 1;
+    if (rank < nr_close) {
+      h--;
+    } else {
+      rank -= nr_close;
+      w |= 1;
+      h++;
+    }
+  }
+  return w;
+}
+
+// The position of the Dyck word w of length 2n in the Dyck words of length 2n
+// in increasing order, the inverse of unrank_dyck_word
+
+size_t rank_dyck_word(dyck::integer w, size_t n) {
+  size_t rank = 0;
+  size_t h    = 0;
+  for (size_t p = 0; p < 2 * n; p++) {
+    size_t const nr_close
+        = (h == 0 ? 0 : nr_dyck_suffixes(2 * n - p - 1, h - 1));
+    if ((w >> (2 * n - p - 1)) & 1) {
+      rank += nr_close;
+      h++;
+    } else {
+      h--;
+    }
+  }
+  assert(rank < catalan_numbers[n]);
+  return rank;
+}
+
+// Call f(r, w) for the Dyck words w of length 2n in positions r in [begin,
+// end), in order, so that every thread can enumerate its own range of the
+// words. Only the first word is unranked, and the others are found by
+// dyck::next.
+
+template <typename F>
+void for_each_dyck_word(size_t n, size_t begin, size_t end, F f) {
+  if (begin >= end) {
+    return;
+  }
+  dyck::integer w = unrank_dyck_word(begin, n);
+  for (size_t r = begin; r < end; r++, w = dyck::next(w)) {
+    f(r, w);
+  }
+}
+
+// Make the Dyck words of length 2n in positions [begin, end), see
+// for_each_dyck_word
+
+void make_dyck_tile(WordStore& dycks, size_t begin, size_t end, size_t n) {
+  dycks.reset(2 * n, end - begin);
+  for_each_dyck_word(n, begin, end, [&dycks, n](size_t, dyck::integer w) {
+    push_dyck_word(dycks, w, n);
+  });
+}
+
+// The ranges of consecutive words of the tiles. The size of the ranges only
+// depends on the number of words and the budget, and not on the number of
+// threads, so that all the shards of a computation, and a run resumed from a
+// checkpoint with another number of threads, agree on the tiles. It is chosen
+// so that the tiles of max_nr_threads threads use at most the budget, and no
+// more than max_nr_threads threads compare the tiles, see
+// Engine::count_tiles.
+
+class Tiles {
+ public:
+  static size_t const max_size       = 65536;  // words
+  static size_t const max_nr_threads = 64;
+
+  // The budget in bytes, which is max_mem, or the physical memory of the
+  // machine if max_mem is 0, or 0 if neither is known
+  static size_t budget(size_t max_mem) {
+    return (max_mem != 0 ? max_mem : physical_memory());
+  }
+
+  // Returns true if nr_words words, each of which uses word_memory bytes,
+  // use more than the budget for max_mem.
+  static bool required(size_t nr_words, size_t word_memory, size_t max_mem) {
+    size_t const mem = budget(max_mem);
+    return mem != 0 && nr_words * word_memory > mem;
+  }
+
+  Tiles(size_t nr_words, size_t word_memory, size_t max_mem)
+      : _nr_words(nr_words),
+        _size(std::max(
+            std::min({nr_words,
+                      max_size,
+                      budget(max_mem) / (2 * max_nr_threads * word_memory)}),
+            (size_t) 1)) {}
+
+  // The number of words in a range
+  size_t size() const {
+    return _size;
+  }
+
+  // The number of ranges
+  size_t nr_ranges() const {
+    return (_nr_words + _size - 1) / _size;
+  }
+
+  size_t begin(size_t I) const {
+    return I * _size;
+  }
+
+  size_t end(size_t I) const {
+    return std::min((I + 1) * _size, _nr_words);
+  }
+
+  // The tiles (I, J) with I <= J
+  PairSpace space() const {
+    return PairSpace(TRIANGLE_DIAG, nr_ranges());
+  }
+
+ private:
+  size_t _nr_words;
+  size_t _size;
+};
+
+// Compare the tiles, where make_tile(words, begin, end) puts the words in
+// positions [begin, end) into words, which is a store of type S, and
+// count_tile(rows, cols, diagonal, sum) adds the number of idempotents from
+// the pairs (i, j) of the words i in rows and j in cols to sum. If diagonal
+// is true, then rows and cols are the same words, and only the pairs with
+// i <= j are counted. The blocks of the scheduler are the tiles, see
+// run_pairs. A row of tiles can have too many pairs for a 64-bit sum, and so
+// the sum of every tile is added in 128 bits.
+
+template <typename S, typename G, typename F>
+std::vector<double> run_tiles(Tiles const&            tiles,
+                              size_t                  nr_threads,
+                              std::vector<uint128_t>& nr_idempotents,
+                              Checkpoint&             checkpoint,
+                              Shard const&            shard,
+                              bool                    verbose,
+                              G&&                     make_tile,
+                              F&&                     count_tile) {
+  PairSpace const space = tiles.space();
+  return run_pairs<uint128_t, WordStore>(
+      space,
+      uniform_blocks(space, shard, 1),
+      nullptr,
+      nr_threads,
+      nr_idempotents,
+      checkpoint,
+      verbose,
+      [&tiles, &make_tile, &count_tile](
+          size_t I, size_t J_begin, size_t J_end, uint128_t& sum) {
+        S rows, cols;
+        make_tile(rows, tiles.begin(I), tiles.end(I));
+        for (size_t J = J_begin; J < J_end; J++) {
+          size_t tile = 0;
+          if (J == I) {
+            count_tile(rows, rows, true, tile);
+          } else {
+            make_tile(cols, tiles.begin(J), tiles.end(J));
+            count_tile(rows, cols, false, tile);
+          }
+          sum += tile;
+        }
+      });
+}
+
+#endif  // TILES_H_
@@ -60,13 +60,25 @@ class Timer {
     _running = false;
   }
 
+  // Elapsed time in seconds
+  //
+  // If the timer is running, then this returns the time elapsed since <start>
+  // was called, and 0 otherwise.
+  double elapsed() const {
+    if (_running) {
+      return std::chrono::duration<double>(std::chrono::steady_clock::now()
+                                           - _start)
+          .count();
+    }
+    return 0;
+  }
+
   // Print elapsed time
   // @str prepend this to the printed statement (defaults to "")
   //
   // If the timer is running, then this prints the time elapsed since <start>
   // was called. The format of the returned value is the time in some
   // (hopefully) human readable format.
-
   void print(std::string prefix = "") {
     if (_running) {
       std::cout << string(prefix);
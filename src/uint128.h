@@ -0,0 +1,69 @@
+/*******************************************************************************
+
+ Copyright (C) 2016 James D. Mitchell
+
+ This work is licensed under a Creative Commons Attribution-ShareAlike 4.0
+ International License. See
+ http://creativecommons.org/licenses/by-sa/4.0/
+
+*******************************************************************************/
+
+// The numbers of idempotents of the larger degrees do not fit in 64 bits, and
+// so the sums of the threads, the phases, and the shards are unsigned 128-bit
+// integers. The kernels still add up the pairs of one row of a block in 64
+// bits, see run_pairs in scheduler.h, using add_checked where a row might
+// overflow, and only these sums of rows are added in 128 bits.
+
+#ifndef UINT128_H_
+#define UINT128_H_
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+__extension__ typedef unsigned __int128 uint128_t;
+
+inline std::string to_string(uint128_t x) {
+  std::string s;
+  do {
+    s += static_cast<char>('0' + static_cast<int>(x % 10));
+    x /= 10;
+  } while (x != 0);
+  std::reverse(s.begin(), s.end());
+  return s;
+}
+
+inline std::ostream& operator<<(std::ostream& os, uint128_t x) {
+  return os << to_string(x);
+}
+
+// Sets the failbit of is, if the next word is not a number which fits in 128
+// bits
+inline std::istream& operator>>(std::istream& is, uint128_t& x) {
+  std::string s;
+  if (!(is >> s)) {
+    return is;
+  }
+  uint128_t const max = ~static_cast<uint128_t>(0);
+  x                   = 0;
+  for (char c : s) {
+    unsigned const d = c - '0';
+    if (d > 9 || x > (max - d) / 10) {
+      is.setstate(std::ios::failbit);
+      return is;
+    }
+    x = 10 * x + d;
+  }
+  return is;
+}
+
+// sum += x, or exit if this overflows
+inline void add_checked(size_t& sum, size_t x) {
+  if (__builtin_add_overflow(sum, x, &sum)) {
+    std::cerr << "overflow in the sum of a row of pairs" << std::endl;
+    exit(-1);
+  }
+}
+
+#endif  // UINT128_H_
@@ -0,0 +1,286 @@
+/*******************************************************************************
+
+ Copyright (C) 2016 James D. Mitchell
+
+ This work is licensed under a Creative Commons Attribution-ShareAlike 4.0
+ International License. See
+ http://creativecommons.org/licenses/by-sa/4.0/
+
+*******************************************************************************/
+
+#ifndef WORD_STORE_H_
+#define WORD_STORE_H_
+
+#include <assert.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <vector>
+
+typedef uint_fast8_t letter_t;
+typedef uint64_t     word_mask_t;  // bit k is set if position k is in a set
+
+inline word_mask_t bit(size_t pos) {
+  return static_cast<word_mask_t>(1) << pos;
+}
+
+inline size_t popcount(word_mask_t x) {
+  return __builtin_popcountll(x);
+}
+
+// x must not be 0
+inline size_t lowest_bit(word_mask_t x) {
+  return __builtin_ctzll(x);
+}
+
+// A flat store of words of a fixed length, each of which is a matching of the
+// positions [0, length) given by the position word[k] matched to position k
+// (k itself if k is a fixed point). Every word also has a list of outer
+// positions, in increasing order, which is specified by the program.
+//
+// The letters of all words are in one contiguous cache line aligned arena
+// with a fixed stride, which is a power of 2 (at most 64 bytes) so that no
+// word straddles two cache lines. The arena is followed by a cache line of
+// padding, so that the SIMD kernels in cycles.h can read a whole cache line
+// from the start of any word. The outer lists are packed one after the other,
+// with the offset of the first outer position of every word, and the outer
+// positions and fixed points are also stored as bit masks.
+
+class WordStore {
+ public:
+  static size_t const cache_line = 64;  // bytes
+  static size_t const max_length = 64;  // the number of bits in word_mask_t
+
+  WordStore()
+      : _buffer(),
+        _fixed_mask(),
+        _length(0),
+        _letters(nullptr),
+        _outer(),
+        _outer_mask(),
+        _outer_offset(1, 0),
+        _size(0),
+        _stride(0) {}
+
+  // _letters points into _buffer
+  WordStore(WordStore const&) = delete;
+  WordStore& operator=(WordStore const&) = delete;
+
+  // Empty the store, and set the length of the words to length.
+  void reset(size_t length, size_t capacity = 0) {
+    assert(length <= max_length);
+    _length = length;
+    _stride = stride(length);
+    _size = 0;
+    _buffer.clear();
+    _letters = nullptr;
+    _fixed_mask.clear();
+    _outer.clear();
+    _outer_mask.clear();
+    _outer_offset.assign(1, 0);
+    reserve(capacity);
+  }
+
+  // Empty the store, and free the memory used by its words
+  void clear() {
+    std::vector<letter_t>().swap(_buffer);
+    std::vector<word_mask_t>().swap(_fixed_mask);
+    std::vector<letter_t>().swap(_outer);
+    std::vector<word_mask_t>().swap(_outer_mask);
+    std::vector<size_t>().swap(_outer_offset);
+    reset(_length);
+  }
+
+  void reserve(size_t capacity) {
+    if (buffer_size(capacity) <= _buffer.size()) {
+      return;
+    }
+    std::vector<letter_t> buffer(buffer_size(capacity), 0);
+    letter_t*             letters = align(buffer.data());
+    if (_size > 0) {
+      std::copy(_letters, _letters + _size * _stride, letters);
+    }
+    _buffer.swap(buffer);
+    _letters = letters;
+    _fixed_mask.reserve(capacity);
+    _outer_mask.reserve(capacity);
+    _outer_offset.reserve(capacity + 1);
+  }
+
+  // Make this a copy of other, in memory allocated by the calling thread
+  void copy(WordStore const& other) {
+    reset(other._length, other._size);
+    std::copy(other._letters, other._letters + other._size * _stride, _letters);
+    _fixed_mask   = other._fixed_mask;
+    _outer        = other._outer;
+    _outer_mask   = other._outer_mask;
+    _outer_offset = other._outer_offset;
+    _size         = other._size;
+  }
+
+  // Empty the store, and make room for size words of the given length, with
+  // nr_outer outer positions in total, which are then put into the store by
+  // set, in any order, and possibly by several threads.
+  void resize(size_t length, size_t size, size_t nr_outer) {
+    reset(length, size);
+    _fixed_mask.resize(size);
+    _outer.resize(nr_outer);
+    _outer_mask.resize(size);
+    _outer_offset.resize(size + 1);
+    _size = size;
+  }
+
+  // Put the word w with the outer positions [outer_begin, outer_end), in
+  // increasing order, into position i of a store made by resize, where
+  // outer_offset is the number of outer positions of the words before i.
+  void set(size_t          i,
+           size_t          outer_offset,
+           letter_t const* w,
+           letter_t const* outer_begin,
+           letter_t const* outer_end) {
+    assert(i < _size);
+    assert(outer_offset + (outer_end - outer_begin) <= _outer.size());
+    std::copy(w, w + _length, _letters + i * _stride);
+    _fixed_mask[i]       = fixed_points(w);
+    word_mask_t outer    = 0;
+    letter_t*   outer_to = _outer.data() + outer_offset;
+    for (letter_t const* it = outer_begin; it < outer_end; ++it) {
+      assert(*it < _length && (it == outer_begin || it[-1] < *it));
+      *outer_to++ = *it;
+      outer |= bit(*it);
+    }
+    _outer_mask[i]       = outer;
+    _outer_offset[i + 1] = outer_offset + (outer_end - outer_begin);
+  }
+
+  // Append the word w of the length of the store, with no outer positions.
+  void push_back(letter_t const* w) {
+    if (buffer_size(_size + 1) > _buffer.size()) {
+      reserve(std::max(2 * _size, static_cast<size_t>(1024)));
+    }
+    std::copy(w, w + _length, _letters + _size * _stride);
+    _fixed_mask.push_back(fixed_points(w));
+    _outer_mask.push_back(0);
+    _outer_offset.push_back(_outer.size());
+    _size++;
+  }
+
+  // Add pos to the outer positions of the last word, pos must be greater than
+  // the previous outer position of the last word.
+  void push_outer(letter_t pos) {
+    assert(_size > 0 && pos < _length);
+    assert(_outer_offset[_size] == _outer_offset[_size - 1]
+           || _outer.back() < pos);
+    _outer.push_back(pos);
+    _outer_offset[_size]++;
+    _outer_mask[_size - 1] |= bit(pos);
+  }
+
+  size_t size() const {
+    return _size;
+  }
+
+  size_t length() const {
+    return _length;
+  }
+
+  // The letters of word i
+  letter_t const* operator[](size_t i) const {
+    return _letters + i * _stride;
+  }
+
+  letter_t const* outer_begin(size_t i) const {
+    return _outer.data() + _outer_offset[i];
+  }
+
+  letter_t const* outer_end(size_t i) const {
+    return _outer.data() + _outer_offset[i + 1];
+  }
+
+  size_t nr_outer(size_t i) const {
+    return _outer_offset[i + 1] - _outer_offset[i];
+  }
+
+  word_mask_t outer_mask(size_t i) const {
+    return _outer_mask[i];
+  }
+
+  word_mask_t fixed_mask(size_t i) const {
+    return _fixed_mask[i];
+  }
+
+  bool is_outer(size_t i, size_t pos) const {
+    return (_outer_mask[i] >> pos) & 1;
+  }
+
+  bool is_fixed(size_t i, size_t pos) const {
+    return (_fixed_mask[i] >> pos) & 1;
+  }
+
+  // Prefetch the letters and outer masks of the words [begin, end)
+  void prefetch(size_t begin, size_t end) const {
+    for (letter_t const* p = (*this)[begin]; p < (*this)[end];
+         p += cache_line) {
+      __builtin_prefetch(p);
+    }
+    size_t const masks_per_line = cache_line / sizeof(word_mask_t);
+    for (size_t i = begin; i < end; i += masks_per_line) {
+      __builtin_prefetch(&_outer_mask[i]);
+    }
+  }
+
+  // The number of bytes used by the words in the store
+  size_t memory() const {
+    return _size * _stride + _outer.size() * sizeof(letter_t)
+           + _size * (2 * sizeof(word_mask_t) + sizeof(size_t));
+  }
+
+  // An estimate of the number of bytes used by a word of the given length,
+  // with at most length / 2 outer positions
+  static size_t word_memory(size_t length) {
+    return stride(length) + (length / 2) * sizeof(letter_t)
+           + 2 * sizeof(word_mask_t) + sizeof(size_t);
+  }
+
+ private:
+  static size_t stride(size_t length) {
+    size_t stride = 1;
+    while (stride < length) {
+      stride *= 2;
+    }
+    return stride;
+  }
+
+  // The mask of the fixed points of the word w of the length of the store
+  word_mask_t fixed_points(letter_t const* w) const {
+    word_mask_t fixed = 0;
+    for (size_t k = 0; k < _length; k++) {
+      if (w[k] == k) {
+        fixed |= bit(k);
+      }
+    }
+    return fixed;
+  }
+
+  // One cache line for the alignment, and one for the padding
+  size_t buffer_size(size_t capacity) const {
+    return capacity * _stride + 2 * cache_line;
+  }
+
+  static letter_t* align(letter_t* ptr) {
+    uintptr_t const addr = reinterpret_cast<uintptr_t>(ptr);
+    return ptr + (cache_line - addr % cache_line) % cache_line;
+  }
+
+  std::vector<letter_t>    _buffer;
+  std::vector<word_mask_t> _fixed_mask;
+  size_t                   _length;
+  letter_t*                _letters;
+  std::vector<letter_t>    _outer;
+  std::vector<word_mask_t> _outer_mask;
+  std::vector<size_t>      _outer_offset;
+  size_t                   _size;
+  size_t                   _stride;
+};
+
+#endif  // WORD_STORE_H_
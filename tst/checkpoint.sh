@@ -0,0 +1,47 @@
+#!/bin/bash
+set -e
+for prog in jones kauffman motzkin; do
+  if [ ! -f ./$prog ]; then
+    echo "$prog executable not found, please build it!"
+    exit 1
+  fi
+done
+
+if [ -f tst/results ]; then
+  rm -f tst/results
+fi
+
+# Stop the degree at the time limit, with the first number of threads, and
+# check that a checkpoint was written, then resume it with the second number
+# of threads, and check that the checkpoint was deleted
+interrupt_and_resume() {
+  local prog=$1 deg=$2 first=$3 second=$4 status=0
+  rm -f $prog-$deg.ckpt
+  ./$prog -t $first --time-limit 1s $deg > /dev/null 2>&1 || status=$?
+  if [ $status -ne 2 ]; then
+    echo "$prog -t $first $deg exited with status $status, not 2"
+    exit 1
+  fi
+  if [ ! -f $prog-$deg.ckpt ]; then
+    echo "$prog -t $first $deg did not write $prog-$deg.ckpt"
+    exit 1
+  fi
+  ./$prog -t $second --resume $deg 2> /dev/null >> tst/results
+  if [ -f $prog-$deg.ckpt ]; then
+    echo "$prog -t $second --resume $deg did not delete $prog-$deg.ckpt"
+    exit 1
+  fi
+}
+
+interrupt_and_resume jones 21 1 2
+interrupt_and_resume kauffman 21 1 2
+# motzkin counts the ranks concurrently with 2 threads, and one after the
+# other with 1, and the checkpoints of each must resume in the other way
+interrupt_and_resume motzkin 12 2 1
+interrupt_and_resume motzkin 12 1 2
+
+diff tst/results tst/expected-checkpoint
+
+if [ -f tst/results ]; then
+  rm -f tst/results
+fi
@@ -0,0 +1,26 @@
+#!/bin/bash
+set -e
+for prog in jones kauffman motzkin; do
+  if [ ! -f ./$prog ]; then
+    echo "$prog executable not found, please build it!"
+    exit 1
+  fi
+done
+
+if [ -f tst/results ]; then
+  rm -f tst/results
+fi
+
+# Compute every degree with more threads than the small degrees would use by
+# default, with each of the schedulers and pinning policies, and tiny blocks
+for prog in jones kauffman motzkin; do
+  for opts in "-t 3 --scheduler static --chunk 1 --pin cores" \
+              "-t 5 --scheduler dynamic --chunk 7 --pin numa"; do
+    for i in {1..11}
+    do
+      ./$prog $opts $i >> tst/results
+    done
+    head -n 11 tst/expected-$prog | diff tst/results -
+    rm -f tst/results
+  done
+done
@@ -0,0 +1,28 @@
+#!/bin/bash
+set -e
+for prog in jones kauffman motzkin; do
+  if [ ! -f ./$prog ]; then
+    echo "$prog executable not found, please build it!"
+    exit 1
+  fi
+done
+
+if [ -f tst/results ]; then
+  rm -f tst/results
+fi
+
+# Compute every degree in 3 shards, and merge them
+for prog in jones kauffman motzkin; do
+  for i in {1..11}
+  do
+    for k in 1 2 3
+    do
+      ./$prog --shard $k/3 $i > /dev/null 2>&1
+    done
+    ./$prog --merge $prog-$i.1-of-3.manifest $prog-$i.2-of-3.manifest \
+                    $prog-$i.3-of-3.manifest >> tst/results
+    rm -f $prog-$i.*-of-3.manifest
+  done
+  head -n 11 tst/expected-$prog | diff tst/results -
+  rm -f tst/results
+done
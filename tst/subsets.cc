@@ -0,0 +1,108 @@
+/*******************************************************************************
+
+ Copyright (C) 2016 James D. Mitchell
+
+ This work is licensed under a Creative Commons Attribution-ShareAlike 4.0
+ International License. See
+ http://creativecommons.org/licenses/by-sa/4.0/
+
+ Checks that the subsets of fixed points of the Motzkin words, and the words
+ themselves, are made correctly for the largest degree, where the subsets
+ have more than 32 elements, see motzkin.h. This is built and run by make
+ test.
+
+*******************************************************************************/
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <vector>
+
+#include "../src/motzkin.h"
+
+static size_t const set_size = 40;
+static size_t       nr_failures = 0;
+
+void check(bool ok, char const* what, size_t k, size_t rank) {
+  if (!ok) {
+    std::cerr << "subsets: " << what << " fails for k = " << k
+              << ", rank = " << rank << std::endl;
+    nr_failures++;
+  }
+}
+
+// The subsets of size k in a few ranges of ranks, including the first and
+// the last, are the next subsets of those before them, and have k elements
+void check_subsets(size_t k) {
+  size_t const        nr = binomial(set_size, k);
+  std::vector<size_t> starts
+      = {0, nr / 3, nr / 2, nr - std::min(nr, (size_t) 1000)};
+  for (size_t start : starts) {
+    subset_t s = unrank_subset(start, k, set_size);
+    for (size_t r = start; r < std::min(start + 1000, nr); r++) {
+      check(s == unrank_subset(r, k, set_size), "next_subset", k, r);
+      check(static_cast<size_t>(__builtin_popcountll(s)) == k, "size", k, r);
+      check(s >> set_size == 0, "bounds", k, r);
+      if (r + 1 < nr) {
+        s = next_subset(s);
+      }
+    }
+  }
+  subset_t const all = (static_cast<subset_t>(1) << set_size) - 1;
+  check(unrank_subset(0, k, set_size) == (all >> (set_size - k)), "first", k, 0);
+  check(unrank_subset(nr - 1, k, set_size) == ((all >> (set_size - k))
+                                                << (set_size - k)),
+        "last",
+        k,
+        nr - 1);
+}
+
+// The odd rank Motzkin words of degree set_size in a range of ranks, which
+// are made by for_each_motzkin_word, are the same as those made by
+// unrank_motzkin_word, which the streaming mode uses, and every position
+// which is not a fixed point is matched with another position.
+void check_words(size_t begin, size_t end) {
+  size_t const                        length = set_size + 1;
+  std::function<size_t(size_t)> const subset_size
+      = [](size_t m) { return set_size + 1 - 2 * m; };
+  for_each_motzkin_word(
+      begin,
+      end,
+      length,
+      1,
+      set_size,
+      subset_size,
+      [&](size_t r, letter_t const* word) {
+        letter_t unranked[WordStore::max_length];
+        unrank_motzkin_word(r, length, 1, set_size, subset_size, unranked);
+        check(std::equal(word, word + length, unranked), "unrank", 0, r);
+        for (size_t j = 0; j < length; j++) {
+          check(word[j] < length && word[word[j]] == j, "matching", 0, r);
+        }
+      });
+}
+
+int main() {
+  for (size_t k : {1, 2, 20, 31, 32, 33, 38, 39, 40}) {
+    check_subsets(k);
+  }
+  // the first words with 1, 2, and 19 matched pairs, which have 39, 37, and
+  // 3 fixed points, and the last of these
+  size_t first = 0;
+  for (size_t m = 1; m <= 19; m++) {
+    size_t const nr
+        = catalan_numbers[m] * binomial(set_size, set_size + 1 - 2 * m);
+    if (m == 1 || m == 2 || m == 19) {
+      check_words(first, first + std::min(nr, (size_t) 1000));
+      check_words(first + nr - std::min(nr, (size_t) 1000), first + nr);
+    }
+    first += nr;
+  }
+  if (nr_failures != 0) {
+    std::cerr << "subsets: " << nr_failures << " failures" << std::endl;
+    exit(1);
+  }
+  exit(0);
+}
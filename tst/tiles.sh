@@ -0,0 +1,28 @@
+#!/bin/bash
+set -e
+for prog in jones kauffman motzkin; do
+  if [ ! -f ./$prog ]; then
+    echo "$prog executable not found, please build it!"
+    exit 1
+  fi
+done
+
+if [ -f tst/results ]; then
+  rm -f tst/results
+fi
+
+# Compute every degree in the streaming mode, with tiny tiles, and in 2 shards
+for prog in jones kauffman motzkin; do
+  for i in {1..11}
+  do
+    for k in 1 2
+    do
+      ./$prog --max-mem 1K --shard $k/2 $i > /dev/null 2>&1
+    done
+    ./$prog --merge $prog-$i.1-of-2.manifest $prog-$i.2-of-2.manifest \
+                    >> tst/results
+    rm -f $prog-$i.*-of-2.manifest
+  done
+  head -n 11 tst/expected-$prog | diff tst/results -
+  rm -f tst/results
+done